@@ -0,0 +1,308 @@
+#pragma once
+
+#include <omp.h>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+#include "bucket_policy.h"
+#include "cache_line.h"
+#include "hash.h"
+
+namespace hpmr {
+// A bucket of a BareAtomicContainer. Sets store no value.
+template <class K, class V>
+struct AtomicSlot {
+  K key;
+  V value;
+
+  // Copies all but the key, which is published on its own.
+  void copy_value(const AtomicSlot& slot) { value = slot.value; }
+};
+
+template <class K>
+struct AtomicSlot<K, void> {
+  K key;
+
+  void copy_value(const AtomicSlot&) {}
+};
+
+// What BareAtomicMap::set and BareAtomicSet::set did with the key. UPDATED means the key was
+// already there, and its value was reduced for maps. REFUSED means the key was new but not inserted
+// because the container is overloaded, see BareAtomicContainer::is_overloaded.
+enum class AtomicSetResult { INSERTED, UPDATED, REFUSED };
+
+// A phase concurrent hash container of integer keys. Threads insert and look up at the same time
+// without locks, thread caches or sync: an insert claims an empty bucket with a compare and swap of
+// its key to locked_key, fills the value and then publishes the key, and threads that meet a locked
+// bucket wait for the key. Entries are never removed and the table never grows on its own, so
+// reserve for all the keys of an insert phase before it starts. Once the keys pass the max load
+// factor, inserts of new keys are refused and return AtomicSetResult::REFUSED instead, which
+// is_overloaded also reports at the end of the phase. Reserve and clear must not run concurrently
+// with anything else. Hash values passed in must match H, which rehashing uses.
+template <
+    class K,
+    class V,
+    class H = Hash<K>,
+    class P = PowerOfTwoBucketPolicy,
+    class A = std::allocator<char>>
+class BareAtomicContainer {
+  static_assert(std::is_integral<K>::value, "Keys must be integers.");
+  static_assert(
+      !P::ROBIN_HOOD && P::N_REHASH_STEP_BUCKETS == 0,
+      "Buckets must be probed linearly and rehashed at once.");
+
+ public:
+  constexpr static float DEFAULT_MAX_LOAD_FACTOR = 0.7;
+
+  constexpr static size_t PARALLEL_REHASH_MIN_BUCKETS = 1 << 18;
+
+  constexpr static size_t MAX_N_REPORT_KEYS = 256;
+
+  // Key count stripes per thread, so that inserts rarely share a counter.
+  constexpr static size_t N_STRIPES_PER_THREAD = 4;
+
+  // Takes effect at the next reserve or clear.
+  float max_load_factor;
+
+  // The two keys mark empty buckets and buckets being filled, and cannot be inserted.
+  explicit BareAtomicContainer(
+      const K empty_key = std::numeric_limits<K>::max(),
+      const K locked_key = std::numeric_limits<K>::max() - 1);
+
+  // Rehashes into enough buckets for n_keys_min keys at the max load factor. Not thread safe.
+  void reserve(const size_t n_keys_min);
+
+  size_t get_n_keys() const;
+
+  size_t get_n_buckets() const { return n_buckets; }
+
+  float get_load_factor() const { return static_cast<float>(get_n_keys()) / n_buckets; }
+
+  // Whether the keys passed the max load factor since the last reserve or clear, so that inserts
+  // of new keys may have been refused. Check at the end of an insert phase, then reserve more and
+  // insert again the keys whose set returned AtomicSetResult::REFUSED.
+  bool is_overloaded() const { return __atomic_load_n(&overloaded, __ATOMIC_RELAXED); }
+
+  // Not thread safe.
+  void clear();
+
+ protected:
+  template <class T>
+  using Vector = std::vector<T, typename std::allocator_traits<A>::template rebind_alloc<T>>;
+
+  typedef AtomicSlot<K, V> Slot;
+
+  K empty_key;
+
+  K locked_key;
+
+  size_t n_buckets;
+
+  H hasher;
+
+  Vector<Slot> slots;
+
+  // Keys inserted into the buckets of each stripe, picked by the low bits of the bucket id, so that
+  // the count does not depend on the thread. Each stripe adds its keys to n_reported_keys in
+  // batches of n_report_keys, counted from n_keys_at_init.
+  struct KeyCountStripe {
+    size_t n_keys;
+
+    size_t n_keys_at_init;
+  };
+
+  CacheLineVector<CacheLinePadded<KeyCountStripe>> key_count_stripes;
+
+  size_t n_reported_keys;
+
+  // Keys allowed by the max load factor.
+  size_t max_n_keys;
+
+  // Small enough that the unreported keys of all the stripes fit into the buckets above
+  // max_n_keys, so the overload is seen before the table is full.
+  size_t n_report_keys;
+
+  bool overloaded;
+
+  // Returns the bucket of the key, or nullptr if the key is absent.
+  const Slot* find(const K& key, const size_t hash_value) const;
+
+  // Returns the bucket of the key. If the key is new, sets claimed and leaves the bucket locked
+  // for the caller to fill and publish, or returns nullptr if the table is overloaded.
+  Slot* claim(const K& key, const size_t hash_value, bool& claimed);
+
+  // Makes the key of a claimed bucket visible, after its value, and counts it.
+  void publish(Slot* slot, const K& key);
+
+  // Calls handler(const Slot&) on every filled bucket, in parallel.
+  template <class F>
+  void for_each_slot(const F& handler) const;
+
+ private:
+  // Waits while another thread fills the bucket and returns its key.
+  K load_key(const Slot& slot) const;
+
+  void store_key(Slot* slot, const K& key);
+
+  void check_key(const K& key) const;
+
+  // Also restarts the overload check with the keys counted so far, and clears the overload.
+  void init_slots(const size_t n_buckets);
+};
+
+template <class K, class V, class H, class P, class A>
+BareAtomicContainer<K, V, H, P, A>::BareAtomicContainer(const K empty_key, const K locked_key) {
+  if (empty_key == locked_key) throw std::invalid_argument("Empty and locked keys must differ.");
+  this->empty_key = empty_key;
+  this->locked_key = locked_key;
+  max_load_factor = DEFAULT_MAX_LOAD_FACTOR;
+  size_t n_stripes = 1;
+  while (n_stripes < omp_get_max_threads() * N_STRIPES_PER_THREAD) n_stripes <<= 1;
+  key_count_stripes.resize(n_stripes);
+  init_slots(P::get_n_initial_buckets());
+}
+
+template <class K, class V, class H, class P, class A>
+void BareAtomicContainer<K, V, H, P, A>::reserve(const size_t n_keys_min) {
+  const size_t n_buckets_min = static_cast<size_t>(std::ceil(n_keys_min / max_load_factor));
+  if (n_buckets_min <= n_buckets) return;
+  Vector<Slot> old_slots;
+  old_slots.swap(slots);
+  init_slots(P::get_n_buckets(n_buckets_min));
+  const size_t n_old_buckets = old_slots.size();
+#pragma omp parallel for schedule(static, 4096) if ( \
+    n_old_buckets >= PARALLEL_REHASH_MIN_BUCKETS && !omp_in_parallel())
+  for (size_t i = 0; i < n_old_buckets; i++) {
+    const Slot& old_slot = old_slots[i];
+    if (old_slot.key == empty_key) continue;
+    bool claimed;
+    Slot* slot = claim(old_slot.key, hasher(old_slot.key), claimed);
+    slot->copy_value(old_slot);
+    store_key(slot, old_slot.key);
+  }
+  overloaded = n_reported_keys > max_n_keys;
+}
+
+template <class K, class V, class H, class P, class A>
+size_t BareAtomicContainer<K, V, H, P, A>::get_n_keys() const {
+  size_t n_keys = 0;
+  for (const auto& stripe : key_count_stripes) {
+    n_keys += __atomic_load_n(&stripe.n_keys, __ATOMIC_RELAXED);
+  }
+  return n_keys;
+}
+
+template <class K, class V, class H, class P, class A>
+void BareAtomicContainer<K, V, H, P, A>::clear() {
+  for (auto& stripe : key_count_stripes) stripe.n_keys = 0;
+  init_slots(n_buckets);
+}
+
+template <class K, class V, class H, class P, class A>
+const typename BareAtomicContainer<K, V, H, P, A>::Slot* BareAtomicContainer<K, V, H, P, A>::find(
+    const K& key, const size_t hash_value) const {
+  check_key(key);
+  size_t bucket_id = P::get_bucket_id(hash_value, n_buckets);
+  for (size_t n_probes = 0; n_probes < n_buckets; n_probes++) {
+    const Slot& slot = slots[bucket_id];
+    const K slot_key = load_key(slot);
+    if (slot_key == key) return &slot;
+    if (slot_key == empty_key) return nullptr;
+    bucket_id = P::get_next_bucket_id(bucket_id, n_buckets);
+  }
+  return nullptr;
+}
+
+template <class K, class V, class H, class P, class A>
+typename BareAtomicContainer<K, V, H, P, A>::Slot* BareAtomicContainer<K, V, H, P, A>::claim(
+    const K& key, const size_t hash_value, bool& claimed) {
+  check_key(key);
+  size_t bucket_id = P::get_bucket_id(hash_value, n_buckets);
+  for (size_t n_probes = 0; n_probes < n_buckets; n_probes++) {
+    Slot& slot = slots[bucket_id];
+    K slot_key = load_key(slot);
+    if (slot_key == empty_key) {
+      if (is_overloaded()) return nullptr;
+      K desired = locked_key;
+      if (__atomic_compare_exchange(
+              &slot.key, &slot_key, &desired, false, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+        claimed = true;
+        return &slot;
+      }
+      // Lost the bucket to another thread, which may be inserting the same key.
+      if (slot_key == locked_key) slot_key = load_key(slot);
+    }
+    if (slot_key == key) {
+      claimed = false;
+      return &slot;
+    }
+    bucket_id = P::get_next_bucket_id(bucket_id, n_buckets);
+  }
+  __atomic_store_n(&overloaded, true, __ATOMIC_RELAXED);
+  return nullptr;
+}
+
+template <class K, class V, class H, class P, class A>
+void BareAtomicContainer<K, V, H, P, A>::publish(Slot* slot, const K& key) {
+  store_key(slot, key);
+  const size_t bucket_id = static_cast<size_t>(slot - slots.data());
+  auto& stripe = key_count_stripes[bucket_id & (key_count_stripes.size() - 1)];
+  const size_t n_stripe_keys = __atomic_add_fetch(&stripe.n_keys, 1, __ATOMIC_RELAXED);
+  if ((n_stripe_keys - stripe.n_keys_at_init) % n_report_keys != 0) return;
+  const size_t n_keys = __atomic_add_fetch(&n_reported_keys, n_report_keys, __ATOMIC_RELAXED);
+  if (n_keys > max_n_keys) __atomic_store_n(&overloaded, true, __ATOMIC_RELAXED);
+}
+
+template <class K, class V, class H, class P, class A>
+template <class F>
+void BareAtomicContainer<K, V, H, P, A>::for_each_slot(const F& handler) const {
+#pragma omp parallel for schedule(static, 4096)
+  for (size_t i = 0; i < n_buckets; i++) {
+    const Slot& slot = slots[i];
+    if (load_key(slot) != empty_key) handler(slot);
+  }
+}
+
+template <class K, class V, class H, class P, class A>
+K BareAtomicContainer<K, V, H, P, A>::load_key(const Slot& slot) const {
+  K key;
+  do {
+    __atomic_load(&slot.key, &key, __ATOMIC_ACQUIRE);
+  } while (key == locked_key);
+  return key;
+}
+
+template <class K, class V, class H, class P, class A>
+void BareAtomicContainer<K, V, H, P, A>::store_key(Slot* slot, const K& key) {
+  K stored_key = key;
+  __atomic_store(&slot->key, &stored_key, __ATOMIC_RELEASE);
+}
+
+template <class K, class V, class H, class P, class A>
+void BareAtomicContainer<K, V, H, P, A>::check_key(const K& key) const {
+  if (key == empty_key || key == locked_key) {
+    throw std::invalid_argument("Key is reserved for empty or locked buckets.");
+  }
+}
+
+template <class K, class V, class H, class P, class A>
+void BareAtomicContainer<K, V, H, P, A>::init_slots(const size_t n_buckets) {
+  this->n_buckets = n_buckets;
+  Slot empty_slot = Slot();
+  empty_slot.key = empty_key;
+  slots.assign(n_buckets, empty_slot);
+  const size_t n_load_keys = static_cast<size_t>(n_buckets * static_cast<double>(max_load_factor));
+  max_n_keys = std::min(n_load_keys, n_buckets - 1);
+  const size_t n_stripes = key_count_stripes.size();
+  n_report_keys = std::max<size_t>(1, (n_buckets - max_n_keys) / n_stripes);
+  n_report_keys = std::min(n_report_keys, MAX_N_REPORT_KEYS);
+  for (auto& stripe : key_count_stripes) stripe.n_keys_at_init = stripe.n_keys;
+  n_reported_keys = get_n_keys();
+  overloaded = false;
+}
+
+}  // namespace hpmr
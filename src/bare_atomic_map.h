@@ -0,0 +1,83 @@
+#pragma once
+
+#include <functional>
+#include <type_traits>
+#include "bare_atomic_container.h"
+#include "reducer.h"
+
+namespace hpmr {
+
+// A phase concurrent map of integer keys to values of at most 8 bytes, see BareAtomicContainer.
+// Reducers apply atomically to values other threads may be reducing, see AtomicReducer.
+template <
+    class K,
+    class V,
+    class H = Hash<K>,
+    class P = PowerOfTwoBucketPolicy,
+    class A = std::allocator<char>>
+class BareAtomicMap : public BareAtomicContainer<K, V, H, P, A> {
+  static_assert(
+      std::is_trivially_copyable<V>::value && sizeof(V) <= 8,
+      "Values must be trivially copyable and at most 8 bytes.");
+
+ public:
+  using BareAtomicContainer<K, V, H, P, A>::BareAtomicContainer;
+
+  // Reducers are taken by type like BareMap::set. New keys are not inserted if the map is
+  // overloaded, which the result tells, so that only those are inserted again. Thread safe.
+  template <class R = typename Reducer<V>::Overwrite>
+  AtomicSetResult set(
+      const K& key, const size_t hash_value, const V& value, const R& reducer = R());
+
+  // Thread safe.
+  V get(const K& key, const size_t hash_value, const V& default_value = V()) const;
+
+  bool has(const K& key, const size_t hash_value) const {
+    return this->find(key, hash_value) != nullptr;
+  }
+
+  // Calls the handler on every entry in parallel.
+  void for_each(
+      const std::function<void(const K& key, const size_t hash_value, const V& value)>& handler)
+      const;
+
+ protected:
+  using typename BareAtomicContainer<K, V, H, P, A>::Slot;
+
+  using BareAtomicContainer<K, V, H, P, A>::hasher;
+};
+
+template <class K, class V, class H, class P, class A>
+template <class R>
+AtomicSetResult BareAtomicMap<K, V, H, P, A>::set(
+    const K& key, const size_t hash_value, const V& value, const R& reducer) {
+  bool claimed;
+  Slot* slot = this->claim(key, hash_value, claimed);
+  if (slot == nullptr) return AtomicSetResult::REFUSED;
+  if (claimed) {
+    slot->value = value;
+    this->publish(slot, key);
+    return AtomicSetResult::INSERTED;
+  }
+  AtomicReducer<V, R>::reduce(slot->value, value, reducer);
+  return AtomicSetResult::UPDATED;
+}
+
+template <class K, class V, class H, class P, class A>
+V BareAtomicMap<K, V, H, P, A>::get(
+    const K& key, const size_t hash_value, const V& default_value) const {
+  const Slot* slot = this->find(key, hash_value);
+  if (slot == nullptr) return default_value;
+  V value;
+  __atomic_load(&slot->value, &value, __ATOMIC_RELAXED);
+  return value;
+}
+
+template <class K, class V, class H, class P, class A>
+void BareAtomicMap<K, V, H, P, A>::for_each(
+    const std::function<void(const K& key, const size_t hash_value, const V& value)>& handler)
+    const {
+  this->for_each_slot([&](const Slot& slot) { handler(slot.key, hasher(slot.key), slot.value); });
+}
+
+}  // namespace hpmr
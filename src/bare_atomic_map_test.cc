@@ -0,0 +1,162 @@
+#include "bare_atomic_map.h"
+
+#include <gtest/gtest.h>
+#include <omp.h>
+#include <stdexcept>
+#include <vector>
+#include "reducer.h"
+
+TEST(BareAtomicMapTest, Initialization) {
+  hpmr::BareAtomicMap<uint64_t, long long> m;
+  EXPECT_EQ(m.get_n_keys(), 0);
+}
+
+TEST(BareAtomicMapTest, Reserve) {
+  hpmr::BareAtomicMap<uint64_t, long long> m;
+  hpmr::Hash<uint64_t> hasher;
+  for (uint64_t i = 0; i < 10; i++) m.set(i, hasher(i), i * i);
+  m.reserve(100000);
+  EXPECT_GE(m.get_n_buckets(), 100000);
+  EXPECT_EQ(m.get_n_keys(), 10);
+  for (uint64_t i = 0; i < 10; i++) EXPECT_EQ(m.get(i, hasher(i)), i * i);
+}
+
+TEST(BareAtomicMapTest, SetAndGet) {
+  hpmr::BareAtomicMap<uint64_t, long long> m;
+  hpmr::Hash<uint64_t> hasher;
+  EXPECT_EQ(m.set(3, hasher(3), 5), hpmr::AtomicSetResult::INSERTED);
+  EXPECT_EQ(m.set(3, hasher(3), 7), hpmr::AtomicSetResult::UPDATED);
+  EXPECT_EQ(m.get(3, hasher(3)), 7);
+  const auto& sum = hpmr::Reducer<long long>::Sum();
+  EXPECT_EQ(m.set(3, hasher(3), 1, sum), hpmr::AtomicSetResult::UPDATED);
+  EXPECT_EQ(m.get(3, hasher(3)), 8);
+  m.set(3, hasher(3), 2, hpmr::Reducer<long long>::Keep());
+  EXPECT_EQ(m.get(3, hasher(3)), 8);
+  EXPECT_TRUE(m.has(3, hasher(3)));
+  EXPECT_FALSE(m.has(4, hasher(4)));
+  EXPECT_EQ(m.get(4, hasher(4), -1), -1);
+  EXPECT_THROW(m.set(UINT64_MAX, hasher(UINT64_MAX), 1), std::invalid_argument);
+}
+
+TEST(BareAtomicMapTest, OverloadRefusesNewKeys) {
+  hpmr::BareAtomicMap<uint64_t, long long> m;
+  hpmr::Hash<uint64_t> hasher;
+  const size_t n_keys = m.get_n_buckets() * 2;
+  std::vector<uint64_t> refused_keys;
+  for (uint64_t i = 0; i < n_keys; i++) {
+    if (m.set(i, hasher(i), 1) == hpmr::AtomicSetResult::REFUSED) refused_keys.push_back(i);
+  }
+  EXPECT_TRUE(m.is_overloaded());
+  EXPECT_EQ(m.get_n_keys(), n_keys - refused_keys.size());
+  EXPECT_LT(m.get_n_keys(), m.get_n_buckets());
+  // Keys already in the map are still updated.
+  const auto& sum = hpmr::Reducer<long long>::Sum();
+  EXPECT_EQ(m.set(0, hasher(0), 2, sum), hpmr::AtomicSetResult::UPDATED);
+  EXPECT_EQ(m.get(0, hasher(0)), 3);
+  m.reserve(n_keys);
+  EXPECT_FALSE(m.is_overloaded());
+  for (const uint64_t key : refused_keys) {
+    EXPECT_EQ(m.set(key, hasher(key), 1), hpmr::AtomicSetResult::INSERTED);
+  }
+  EXPECT_FALSE(m.is_overloaded());
+  EXPECT_EQ(m.get_n_keys(), n_keys);
+  EXPECT_EQ(m.get(0, hasher(0)), 3);
+  EXPECT_EQ(m.get(n_keys - 1, hasher(n_keys - 1)), 1);
+}
+
+TEST(BareAtomicMapTest, ParallelCountAfterOverload) {
+  // Counts stay exact when only the refused contributions are inserted again after reserve.
+  hpmr::BareAtomicMap<uint64_t, long long> m;
+  hpmr::Hash<uint64_t> hasher;
+  constexpr long long N_KEYS = 10000;
+  constexpr long long N_REPEATS = 10;
+  const auto& sum = hpmr::Reducer<long long>::Sum();
+  m.reserve(N_KEYS / 10);
+  std::vector<uint64_t> refused_keys;
+#pragma omp parallel for schedule(static, 1)
+  for (long long i = 0; i < N_KEYS * N_REPEATS; i++) {
+    const uint64_t key = i % N_KEYS;
+    if (m.set(key, hasher(key), 1, sum) == hpmr::AtomicSetResult::REFUSED) {
+#pragma omp critical
+      refused_keys.push_back(key);
+    }
+  }
+  EXPECT_TRUE(m.is_overloaded());
+  m.reserve(N_KEYS);
+  EXPECT_FALSE(m.is_overloaded());
+#pragma omp parallel for
+  for (size_t i = 0; i < refused_keys.size(); i++) {
+    const uint64_t key = refused_keys[i];
+    EXPECT_NE(m.set(key, hasher(key), 1, sum), hpmr::AtomicSetResult::REFUSED);
+  }
+  EXPECT_EQ(m.get_n_keys(), N_KEYS);
+  for (uint64_t key = 0; key < N_KEYS; key++) EXPECT_EQ(m.get(key, hasher(key)), N_REPEATS);
+}
+
+TEST(BareAtomicMapTest, MoreThreadsThanAtConstruction) {
+  hpmr::BareAtomicMap<uint64_t, long long> m;
+  hpmr::Hash<uint64_t> hasher;
+  constexpr long long N_KEYS = 10000;
+  m.reserve(N_KEYS);
+#pragma omp parallel for num_threads(omp_get_max_threads() * 4)
+  for (long long i = 0; i < N_KEYS; i++) m.set(i, hasher(i), i);
+  EXPECT_EQ(m.get_n_keys(), N_KEYS);
+  EXPECT_FALSE(m.is_overloaded());
+}
+
+TEST(BareAtomicMapTest, LargeParallelReserve) {
+  hpmr::BareAtomicMap<uint64_t, long long> m;
+  hpmr::Hash<uint64_t> hasher;
+  constexpr long long N_KEYS = 200000;
+  m.reserve(N_KEYS);
+#pragma omp parallel for
+  for (long long i = 0; i < N_KEYS; i++) m.set(i, hasher(i), i * 3);
+  // Large enough for the rehash to run in parallel.
+  m.reserve(N_KEYS * 4);
+  EXPECT_EQ(m.get_n_keys(), N_KEYS);
+  for (long long i = 0; i < N_KEYS; i++) EXPECT_EQ(m.get(i, hasher(i)), i * 3);
+}
+
+TEST(BareAtomicMapTest, ParallelCount) {
+  hpmr::BareAtomicMap<uint64_t, long long> m;
+  hpmr::Hash<uint64_t> hasher;
+  constexpr long long N_KEYS = 1000;
+  constexpr long long N_REPEATS = 100;
+  m.reserve(N_KEYS);
+#pragma omp parallel for schedule(static, 1)
+  for (long long i = 0; i < N_KEYS * N_REPEATS; i++) {
+    const uint64_t key = i % N_KEYS;
+    m.set(key, hasher(key), 1, hpmr::Reducer<long long>::Sum());
+  }
+  EXPECT_EQ(m.get_n_keys(), N_KEYS);
+  long long n_counts = 0;
+  m.for_each([&](const uint64_t key, const size_t hash_value, const long long value) {
+    EXPECT_LT(key, N_KEYS);
+    EXPECT_EQ(hash_value, hasher(key));
+    EXPECT_EQ(value, N_REPEATS);
+#pragma omp atomic
+    n_counts += value;
+  });
+  EXPECT_EQ(n_counts, N_KEYS * N_REPEATS);
+}
+
+TEST(BareAtomicMapTest, ParallelMinAndMax) {
+  hpmr::BareAtomicMap<uint64_t, long long> min_map;
+  hpmr::BareAtomicMap<uint64_t, long long> max_map;
+  hpmr::Hash<uint64_t> hasher;
+  constexpr long long N_KEYS = 100;
+  constexpr long long N_VALUES = 10000;
+  min_map.reserve(N_KEYS);
+  max_map.reserve(N_KEYS);
+#pragma omp parallel for schedule(static, 1)
+  for (long long i = 0; i < N_VALUES; i++) {
+    const uint64_t key = i % N_KEYS;
+    min_map.set(key, hasher(key), i, hpmr::Reducer<long long>::Min());
+    max_map.set(key, hasher(key), i, hpmr::Reducer<long long>::Max());
+  }
+  // The reducers keep the same values as with BareMap.
+  for (uint64_t key = 0; key < N_KEYS; key++) {
+    EXPECT_EQ(min_map.get(key, hasher(key)), N_VALUES - N_KEYS + key);
+    EXPECT_EQ(max_map.get(key, hasher(key)), key);
+  }
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <functional>
+#include "bare_atomic_container.h"
+
+namespace hpmr {
+
+// A phase concurrent set of integer keys, see BareAtomicContainer.
+template <
+    class K,
+    class H = Hash<K>,
+    class P = PowerOfTwoBucketPolicy,
+    class A = std::allocator<char>>
+class BareAtomicSet : public BareAtomicContainer<K, void, H, P, A> {
+ public:
+  using BareAtomicContainer<K, void, H, P, A>::BareAtomicContainer;
+
+  // Exactly one of the threads inserting a key sees AtomicSetResult::INSERTED. New keys are not
+  // inserted if the set is overloaded, which the result tells. Thread safe.
+  AtomicSetResult set(const K& key, const size_t hash_value);
+
+  bool has(const K& key, const size_t hash_value) const {
+    return this->find(key, hash_value) != nullptr;
+  }
+
+  // Calls the handler on every key in parallel.
+  void for_each(const std::function<void(const K& key, const size_t hash_value)>& handler) const;
+
+ protected:
+  using typename BareAtomicContainer<K, void, H, P, A>::Slot;
+
+  using BareAtomicContainer<K, void, H, P, A>::hasher;
+};
+
+template <class K, class H, class P, class A>
+AtomicSetResult BareAtomicSet<K, H, P, A>::set(const K& key, const size_t hash_value) {
+  bool claimed;
+  Slot* slot = this->claim(key, hash_value, claimed);
+  if (slot == nullptr) return AtomicSetResult::REFUSED;
+  if (!claimed) return AtomicSetResult::UPDATED;
+  this->publish(slot, key);
+  return AtomicSetResult::INSERTED;
+}
+
+template <class K, class H, class P, class A>
+void BareAtomicSet<K, H, P, A>::for_each(
+    const std::function<void(const K& key, const size_t hash_value)>& handler) const {
+  this->for_each_slot([&](const Slot& slot) { handler(slot.key, hasher(slot.key)); });
+}
+
+}  // namespace hpmr
@@ -0,0 +1,59 @@
+#include "bare_atomic_set.h"
+
+#include <gtest/gtest.h>
+
+TEST(BareAtomicSetTest, SetAndHas) {
+  hpmr::BareAtomicSet<uint64_t> m;
+  hpmr::Hash<uint64_t> hasher;
+  EXPECT_EQ(m.set(1, hasher(1)), hpmr::AtomicSetResult::INSERTED);
+  EXPECT_EQ(m.set(1, hasher(1)), hpmr::AtomicSetResult::UPDATED);
+  EXPECT_TRUE(m.has(1, hasher(1)));
+  EXPECT_FALSE(m.has(2, hasher(2)));
+  m.clear();
+  EXPECT_FALSE(m.has(1, hasher(1)));
+  EXPECT_EQ(m.get_n_keys(), 0);
+}
+
+TEST(BareAtomicSetTest, ParallelDedup) {
+  hpmr::BareAtomicSet<uint64_t> m;
+  hpmr::Hash<uint64_t> hasher;
+  constexpr uint64_t N_KEYS = 100000;
+  m.reserve(N_KEYS);
+  size_t n_new_keys = 0;
+#pragma omp parallel for reduction(+ : n_new_keys)
+  for (uint64_t i = 0; i < N_KEYS * 3; i++) {
+    const uint64_t key = i % N_KEYS;
+    if (m.set(key, hasher(key)) == hpmr::AtomicSetResult::INSERTED) n_new_keys++;
+  }
+  EXPECT_EQ(n_new_keys, N_KEYS);
+  EXPECT_EQ(m.get_n_keys(), N_KEYS);
+  EXPECT_LE(m.get_load_factor(), m.max_load_factor);
+  size_t n_visited_keys = 0;
+  m.for_each([&](const uint64_t key, const size_t) {
+    EXPECT_LT(key, N_KEYS);
+#pragma omp atomic
+    n_visited_keys++;
+  });
+  EXPECT_EQ(n_visited_keys, N_KEYS);
+}
+
+TEST(BareAtomicSetTest, ParallelOverload) {
+  hpmr::BareAtomicSet<uint64_t> m;
+  hpmr::Hash<uint64_t> hasher;
+  constexpr uint64_t N_KEYS = 100000;
+  m.reserve(N_KEYS / 100);
+  size_t n_new_keys = 0;
+  size_t n_refused_keys = 0;
+#pragma omp parallel for reduction(+ : n_new_keys, n_refused_keys)
+  for (uint64_t i = 0; i < N_KEYS; i++) {
+    const auto result = m.set(i, hasher(i));
+    if (result == hpmr::AtomicSetResult::INSERTED) n_new_keys++;
+    if (result == hpmr::AtomicSetResult::REFUSED) n_refused_keys++;
+  }
+  EXPECT_TRUE(m.is_overloaded());
+  EXPECT_EQ(m.get_n_keys(), n_new_keys);
+  EXPECT_EQ(n_new_keys + n_refused_keys, N_KEYS);
+  EXPECT_LT(m.get_n_keys(), m.get_n_buckets());
+  m.clear();
+  EXPECT_FALSE(m.is_overloaded());
+}
@@ -5,35 +5,65 @@
 #include <numeric>
 #include <vector>
 #include "../hps/src/hps.h"
+#include "bloom_filter.h"
+#include "cache_line.h"
+#include "hash.h"
+#include "hash_entry.h"
 
 namespace hpmr {
 // A concurrent map that requires providing hash values when use.
-template <class K, class V, class S, class H = std::hash<K>>
+template <class K, class V, class S, class H = Hash<K>, class C = S>
 class BareConcurrentContainer {
  public:
-  constexpr static size_t N_SEGMENTS_PER_THREAD = 8;
+  BareConcurrentContainer() : BareConcurrentContainer(get_default_n_segments()) {}
 
-  BareConcurrentContainer();
+  // Any number of segments works, and each segment has its own lock.
+  explicit BareConcurrentContainer(const size_t n_segments);
 
   BareConcurrentContainer(const BareConcurrentContainer& m);
 
-  ~BareConcurrentContainer();
-
   void reserve(const size_t n_keys_min);
 
   void set_max_load_factor(const float max_load_factor);
 
   float get_max_load_factor() const { return max_load_factor; };
 
+  // Keeps a Bloom filter of the keys of each large segment, so that most lookups of absent keys
+  // return before taking the segment lock. Not thread safe.
+  void set_bloom_filter(const bool enabled);
+
   size_t get_n_keys() const;
 
   size_t get_n_buckets() const;
 
+  size_t get_n_segments() const { return n_segments; }
+
+  // See hpmr::get_default_n_segments.
+  static size_t get_default_n_segments(const size_t n_keys_est = 0) {
+    return hpmr::get_default_n_segments(n_keys_est);
+  }
+
   float get_load_factor();
 
-  void unset(const K& key, const size_t hash_value);
+  void unset(const K& key, const size_t hash_value) { unset<K>(key, hash_value); }
+
+  // Takes keys of other types when the hasher is transparent.
+  template <class KL, class = EnableIfLookupKey<K, KL, H>>
+  void unset(const KL& key, const size_t hash_value);
+
+  bool has(const K& key, const size_t hash_value) { return has<K>(key, hash_value); }
+
+  template <class KL, class = EnableIfLookupKey<K, KL, H>>
+  bool has(const KL& key, const size_t hash_value);
 
-  bool has(const K& key, const size_t hash_value);
+  // Looks up n_batch_keys keys grouped by segment, so each segment lock is taken once per batch.
+  void has_batch(
+      const K* keys, const size_t* hash_values, const size_t n_batch_keys, bool* results);
+
+  // Removes the entries the predicate accepts, with the same arguments as S::erase_if, sweeping the
+  // segments in parallel. Thread caches are not visited, so sync first if async_set was used.
+  template <class F>
+  size_t erase_if(const F& predicate);
 
   void clear();
 
@@ -46,120 +76,176 @@ class BareConcurrentContainer {
  protected:
   size_t n_segments;
 
-  std::vector<S> segments;
+  CacheLineVector<LockedSegment<S>> segments;
 
   size_t n_threads;
 
-  std::vector<S> thread_caches;
+  CacheLineVector<CacheLinePadded<C>> thread_caches;
 
-  std::vector<omp_lock_t> segment_locks;
+  std::vector<SegmentBloomFilter> bloom_filters;
 
  private:
   float max_load_factor;
 
-  bool has_big_prime_factors(const int num);
+  // Sorts the batch indices by segment. The indices of segment i end up in
+  // order[segment_starts[i], segment_starts[i + 1]).
+  void group_by_segment(
+      const size_t* hash_values,
+      const size_t n_batch_keys,
+      std::vector<size_t>& order,
+      std::vector<size_t>& segment_starts) const;
 };
 
-template <class K, class V, class S, class H>
-BareConcurrentContainer<K, V, S, H>::BareConcurrentContainer() {
+template <class K, class V, class S, class H, class C>
+BareConcurrentContainer<K, V, S, H, C>::BareConcurrentContainer(const size_t n_segments) {
+  if (n_segments == 0) throw std::invalid_argument("N segments must be positive.");
   max_load_factor = S::DEFAULT_MAX_LOAD_FACTOR;
   n_threads = omp_get_max_threads();
   thread_caches.resize(n_threads);
-  if (!has_big_prime_factors(n_threads)) {
-    throw std::invalid_argument("N threads has big prime factors, which affects performance.");
-  }
-  n_segments = n_threads * N_SEGMENTS_PER_THREAD;
+  this->n_segments = n_segments;
   segments.resize(n_segments);
-  segment_locks.resize(n_segments);
-  for (auto& lock : segment_locks) omp_init_lock(&lock);
+  bloom_filters.resize(n_segments);
 }
 
-template <class K, class V, class S, class H>
-BareConcurrentContainer<K, V, S, H>::BareConcurrentContainer(const BareConcurrentContainer& m) {
+template <class K, class V, class S, class H, class C>
+BareConcurrentContainer<K, V, S, H, C>::BareConcurrentContainer(const BareConcurrentContainer& m) {
   max_load_factor = m.max_load_factor;
   n_threads = omp_get_max_threads();
   thread_caches.resize(n_threads);
   n_segments = m.n_segments;
   segments = m.segments;
-  segment_locks.resize(n_segments);
-  for (auto& lock : segment_locks) omp_init_lock(&lock);
-}
-
-template <class K, class V, class S, class H>
-BareConcurrentContainer<K, V, S, H>::~BareConcurrentContainer() {
-  for (auto& lock : segment_locks) omp_destroy_lock(&lock);
+  bloom_filters.reserve(n_segments);
+  for (size_t i = 0; i < n_segments; i++) {
+    bloom_filters.push_back(m.bloom_filters[i]);
+    bloom_filters[i].reset(segments[i]);
+  }
 }
 
-template <class K, class V, class S, class H>
-void BareConcurrentContainer<K, V, S, H>::reserve(const size_t n_keys_min) {
+template <class K, class V, class S, class H, class C>
+void BareConcurrentContainer<K, V, S, H, C>::reserve(const size_t n_keys_min) {
   const size_t n_segment_keys_min = n_keys_min / n_segments;
   for (size_t i = 0; i < n_segments; i++) segments.at(i).reserve(n_segment_keys_min);
   const size_t n_thread_keys_est = n_keys_min / 1000;
   for (size_t i = 0; i < n_threads; i++) thread_caches.at(i).reserve(n_thread_keys_est);
 };
 
-template <class K, class V, class S, class H>
-void BareConcurrentContainer<K, V, S, H>::set_max_load_factor(const float max_load_factor) {
+template <class K, class V, class S, class H, class C>
+void BareConcurrentContainer<K, V, S, H, C>::set_max_load_factor(const float max_load_factor) {
   this->max_load_factor = max_load_factor;
   for (size_t i = 0; i < n_segments; i++) segments.at(i).max_load_factor = max_load_factor;
   for (size_t i = 0; i < n_threads; i++) thread_caches.at(i).max_load_factor = max_load_factor;
 }
 
-template <class K, class V, class S, class H>
-size_t BareConcurrentContainer<K, V, S, H>::get_n_keys() const {
+template <class K, class V, class S, class H, class C>
+void BareConcurrentContainer<K, V, S, H, C>::set_bloom_filter(const bool enabled) {
+#pragma omp parallel for schedule(dynamic, 1)
+  for (size_t i = 0; i < n_segments; i++) bloom_filters[i].set_enabled(enabled, segments[i]);
+}
+
+template <class K, class V, class S, class H, class C>
+size_t BareConcurrentContainer<K, V, S, H, C>::get_n_keys() const {
   size_t n_keys = 0;
   for (size_t i = 0; i < n_segments; i++) n_keys += segments.at(i).get_n_keys();
   return n_keys;
 }
 
-template <class K, class V, class S, class H>
-size_t BareConcurrentContainer<K, V, S, H>::get_n_buckets() const {
+template <class K, class V, class S, class H, class C>
+size_t BareConcurrentContainer<K, V, S, H, C>::get_n_buckets() const {
   size_t n_buckets = 0;
   for (size_t i = 0; i < n_segments; i++) n_buckets += segments.at(i).get_n_buckets();
   return n_buckets;
 }
 
-template <class K, class V, class S, class H>
-void BareConcurrentContainer<K, V, S, H>::unset(const K& key, const size_t hash_value) {
-  const size_t segment_id = hash_value % n_segments;
-  auto& lock = segment_locks[segment_id];
-  omp_set_lock(&lock);
-  segments.at(segment_id).unset(key, hash_value);
-  omp_unset_lock(&lock);
+template <class K, class V, class S, class H, class C>
+template <class KL, class>
+void BareConcurrentContainer<K, V, S, H, C>::unset(const KL& key, const size_t hash_value) {
+  const size_t segment_id = get_segment_id(hash_value, n_segments);
+  if (!bloom_filters[segment_id].may_contain(hash_value)) return;
+  auto& segment = segments[segment_id];
+  segment.lock();
+  segment.unset(key, hash_value);
+  segment.unlock();
 }
 
-template <class K, class V, class S, class H>
-bool BareConcurrentContainer<K, V, S, H>::has(const K& key, const size_t hash_value) {
-  const size_t segment_id = hash_value % n_segments;
-  auto& lock = segment_locks[segment_id];
-  omp_set_lock(&lock);
-  bool res = segments.at(segment_id).has(key, hash_value);
-  omp_unset_lock(&lock);
+template <class K, class V, class S, class H, class C>
+template <class KL, class>
+bool BareConcurrentContainer<K, V, S, H, C>::has(const KL& key, const size_t hash_value) {
+  const size_t segment_id = get_segment_id(hash_value, n_segments);
+  if (!bloom_filters[segment_id].may_contain(hash_value)) return false;
+  auto& segment = segments[segment_id];
+  segment.lock();
+  bool res = segment.has(key, hash_value);
+  segment.unlock();
   return res;
 }
 
-template <class K, class V, class S, class H>
-void BareConcurrentContainer<K, V, S, H>::clear() {
-  for (size_t i = 0; i < n_segments; i++) segments.at(i).clear();
+template <class K, class V, class S, class H, class C>
+void BareConcurrentContainer<K, V, S, H, C>::has_batch(
+    const K* keys, const size_t* hash_values, const size_t n_batch_keys, bool* results) {
+  constexpr size_t PREFETCH_DISTANCE = S::BATCH_PREFETCH_DISTANCE;
+  std::vector<size_t> order;
+  std::vector<size_t> segment_starts;
+  group_by_segment(hash_values, n_batch_keys, order, segment_starts);
+  for (size_t segment_id = 0; segment_id < n_segments; segment_id++) {
+    const size_t begin = segment_starts[segment_id];
+    const size_t end = segment_starts[segment_id + 1];
+    if (begin == end) continue;
+    auto& segment = segments[segment_id];
+    segment.lock();
+    for (size_t j = begin; j < end && j < begin + PREFETCH_DISTANCE; j++) {
+      segment.prefetch(hash_values[order[j]]);
+    }
+    for (size_t j = begin; j < end; j++) {
+      if (j + PREFETCH_DISTANCE < end) segment.prefetch(hash_values[order[j + PREFETCH_DISTANCE]]);
+      const size_t i = order[j];
+      results[i] = segment.has(keys[i], hash_values[i]);
+    }
+    segment.unlock();
+  }
+}
+
+template <class K, class V, class S, class H, class C>
+template <class F>
+size_t BareConcurrentContainer<K, V, S, H, C>::erase_if(const F& predicate) {
+  size_t n_erased = 0;
+#pragma omp parallel for schedule(dynamic, 1) reduction(+ : n_erased)
+  for (size_t i = 0; i < n_segments; i++) {
+    auto& segment = segments[i];
+    segment.lock();
+    n_erased += segment.erase_if(predicate);
+    segment.unlock();
+  }
+  return n_erased;
+}
+
+template <class K, class V, class S, class H, class C>
+void BareConcurrentContainer<K, V, S, H, C>::clear() {
+  for (size_t i = 0; i < n_segments; i++) {
+    segments.at(i).clear();
+    bloom_filters[i].reset(segments[i]);
+  }
   for (size_t i = 0; i < n_threads; i++) thread_caches.at(i).clear();
 }
 
-template <class K, class V, class S, class H>
-void BareConcurrentContainer<K, V, S, H>::clear_and_shrink() {
-  for (size_t i = 0; i < n_segments; i++) segments.at(i).clear_and_shrink();
+template <class K, class V, class S, class H, class C>
+void BareConcurrentContainer<K, V, S, H, C>::clear_and_shrink() {
+  for (size_t i = 0; i < n_segments; i++) {
+    segments.at(i).clear_and_shrink();
+    bloom_filters[i].reset(segments[i]);
+  }
   for (size_t i = 0; i < n_threads; i++) thread_caches.at(i).clear_and_shrink();
 }
 
-template <class K, class V, class S, class H>
-std::string BareConcurrentContainer<K, V, S, H>::to_string() {
+template <class K, class V, class S, class H, class C>
+std::string BareConcurrentContainer<K, V, S, H, C>::to_string() {
   std::vector<std::string> ostrs(n_segments);
   size_t total_size = 0;
 #pragma omp parallel for
   for (size_t i = 0; i < n_segments; i++) {
-    auto& lock = segment_locks[i];
-    omp_set_lock(&lock);
-    hps::serialize_to_string(segments.at(i), ostrs.at(i));
-    omp_unset_lock(&lock);
+    auto& segment = segments[i];
+    segment.lock();
+    hps::serialize_to_string(segment.get_table(), ostrs.at(i));
+    segment.unlock();
 #pragma omp atomic
     total_size += ostrs[i].size();
   }
@@ -167,6 +253,7 @@ std::string BareConcurrentContainer<K, V, S, H>::to_string() {
   str.reserve(total_size + n_segments * 8);
   hps::OutputBuffer<std::string> ob_str(str);
   hps::Serializer<float, std::string>::serialize(max_load_factor, ob_str);
+  hps::Serializer<size_t, std::string>::serialize(n_segments, ob_str);
   for (size_t i = 0; i < n_segments; i++) {
     hps::Serializer<std::string, std::string>::serialize(ostrs[i], ob_str);
   }
@@ -174,33 +261,61 @@ std::string BareConcurrentContainer<K, V, S, H>::to_string() {
   return str;
 }
 
-template <class K, class V, class S, class H>
-void BareConcurrentContainer<K, V, S, H>::from_string(const std::string& str) {
-  std::vector<std::string> istrs(n_segments);
+template <class K, class V, class S, class H, class C>
+void BareConcurrentContainer<K, V, S, H, C>::from_string(const std::string& str) {
   hps::InputBuffer<std::string> ib_str(str);
   hps::Serializer<float, std::string>::parse(max_load_factor, ib_str);
-  for (size_t i = 0; i < n_segments; i++) {
+  size_t n_str_segments;
+  hps::Serializer<size_t, std::string>::parse(n_str_segments, ib_str);
+  std::vector<std::string> istrs(n_str_segments);
+  for (size_t i = 0; i < n_str_segments; i++) {
     hps::Serializer<std::string, std::string>::parse(istrs[i], ib_str);
   }
+  if (n_str_segments != n_segments) {
+    // Written with another number of segments, so the keys are spread over the segments again.
+    clear();
+    set_max_load_factor(max_load_factor);
+#pragma omp parallel for schedule(dynamic, 1)
+    for (size_t i = 0; i < n_str_segments; i++) {
+      S str_segment;
+      hps::parse_from_string(str_segment, istrs[i]);
+      str_segment.drain([&](K&& key, const size_t hash_value) {
+        const size_t segment_id = get_segment_id(hash_value, n_segments);
+        auto& segment = segments[segment_id];
+        segment.lock();
+        segment.set(std::move(key), hash_value);
+        bloom_filters[segment_id].insert(hash_value, segment);
+        segment.unlock();
+      });
+    }
+    return;
+  }
 #pragma omp parallel for
   for (size_t i = 0; i < n_segments; i++) {
-    auto& lock = segment_locks[i];
-    omp_set_lock(&lock);
-    hps::parse_from_string(segments.at(i), istrs[i]);
-    omp_unset_lock(&lock);
+    auto& segment = segments[i];
+    segment.lock();
+    hps::parse_from_string(segment.get_table(), istrs[i]);
+    bloom_filters[i].reset(segment);
+    segment.unlock();
   }
 }
 
-template <class K, class V, class S, class H>
-bool BareConcurrentContainer<K, V, S, H>::has_big_prime_factors(const int num) {
-  constexpr int SMALL_PRIMES[] = {2, 3, 5, 7};
-  constexpr int N_SMALL_PRIMES = sizeof(SMALL_PRIMES) / sizeof(int);
-  int remain = num;
-  for (int i = 0; i < N_SMALL_PRIMES; i++) {
-    const int prime = SMALL_PRIMES[i];
-    while (remain % prime == 0) remain /= prime;
+template <class K, class V, class S, class H, class C>
+void BareConcurrentContainer<K, V, S, H, C>::group_by_segment(
+    const size_t* hash_values,
+    const size_t n_batch_keys,
+    std::vector<size_t>& order,
+    std::vector<size_t>& segment_starts) const {
+  segment_starts.assign(n_segments + 1, 0);
+  for (size_t i = 0; i < n_batch_keys; i++) {
+    segment_starts[get_segment_id(hash_values[i], n_segments) + 1]++;
+  }
+  std::partial_sum(segment_starts.begin(), segment_starts.end(), segment_starts.begin());
+  std::vector<size_t> segment_cursors(segment_starts.begin(), segment_starts.end() - 1);
+  order.resize(n_batch_keys);
+  for (size_t i = 0; i < n_batch_keys; i++) {
+    order[segment_cursors[get_segment_id(hash_values[i], n_segments)]++] = i;
   }
-  return remain == 1;
 }
 
 }  // namespace hpmr
@@ -1,20 +1,32 @@
 #pragma once
 
 #include <omp.h>
+#include <algorithm>
 #include <functional>
+#include <limits>
 #include <numeric>
+#include "bare_frozen_map.h"
 #include "bare_map.h"
+#include "bloom_filter.h"
+#include "cache_line.h"
 
 namespace hpmr {
 // A concurrent map that requires providing hash values when use.
-template <class K, class V, class H = std::hash<K>>
+template <
+    class K,
+    class V,
+    class H = Hash<K>,
+    class P = PrimeBucketPolicy,
+    class A = std::allocator<char>,
+    class CA = A>
 class BareConcurrentMap {
  public:
-  BareConcurrentMap();
+  BareConcurrentMap() : BareConcurrentMap(get_default_n_segments()) {}
 
-  BareConcurrentMap(const BareConcurrentMap& m);
+  // Any number of segments works, and each segment has its own lock.
+  explicit BareConcurrentMap(const size_t n_segments);
 
-  ~BareConcurrentMap();
+  BareConcurrentMap(const BareConcurrentMap& m);
 
   void reserve(const size_t n_keys_min);
 
@@ -22,31 +34,112 @@ class BareConcurrentMap {
 
   float get_max_load_factor() const { return max_load_factor; };
 
+  // Keeps a Bloom filter of the keys of each large segment, so that most lookups of absent keys
+  // return before taking the segment lock. Not thread safe.
+  void set_bloom_filter(const bool enabled);
+
+  // Lets get and has probe a segment without its lock and retry when a writer overlapped, so reads
+  // do not serialize on hot segments. Only takes effect for trivially copyable keys and values, see
+  // BareHashContainer::OPTIMISTIC_READS. Tables replaced by rehashes are kept until the next sync,
+  // clear or from_string, which therefore must not run concurrently with lookups. Not thread safe.
+  void set_optimistic_reads(const bool enabled);
+
+  // Caps the keys each thread cache holds. A thread whose cache reaches the cap moves the cached
+  // entries into their segments in async_set, one batch per segment, skipping busy segments as long
+  // as the skipped entries fit in half of the cap. Unlimited by default.
+  void set_max_n_thread_cache_keys(const size_t max_n_thread_cache_keys);
+
+  // Caps the thread caches so that their tables take about n_bytes in total. Memory the keys and
+  // values allocate themselves is not counted.
+  void set_thread_cache_budget(const size_t n_bytes);
+
+  // Makes async_set append entries to a small buffer per thread and segment instead of locking the
+  // segment for each key. A full buffer is moved into its segment under a single lock, and sync
+  // moves the rest, so n_buffer_keys keys share each lock. Values of the same key meet with the
+  // reducer of the async_set that fills the buffer, and entries still buffered at sync meet with
+  // the reducer of sync, so both must be the same. 0 turns the buffers off. Call it only when the
+  // buffers are empty, such as after sync. Not thread safe.
+  void set_write_combining(const size_t n_buffer_keys);
+
   size_t get_n_keys() const;
 
   size_t get_n_buckets() const;
 
+  size_t get_n_segments() const { return n_segments; }
+
+  // See hpmr::get_default_n_segments.
+  static size_t get_default_n_segments(const size_t n_keys_est = 0) {
+    return hpmr::get_default_n_segments(n_keys_est);
+  }
+
   float get_load_factor();
 
-  void set(
-      const K& key,
-      const size_t hash_value,
-      const V& value,
-      const std::function<void(V&, const V&)>& reducer = Reducer<V>::overwrite);
+  // Reducers are taken by type like BareMap::set.
+  template <class R = typename Reducer<V>::Overwrite>
+  void set(const K& key, const size_t hash_value, const V& value, const R& reducer = R()) {
+    set_entry(key, hash_value, value, reducer);
+  }
+
+  // Moves the key and the value in if the key is new.
+  template <class R = typename Reducer<V>::Overwrite>
+  void set(K&& key, const size_t hash_value, V&& value, const R& reducer = R()) {
+    set_entry(std::move(key), hash_value, std::move(value), reducer);
+  }
+
+  // Sets the entry if its segment is free and caches it in the calling thread otherwise. There is
+  // one cache per thread of omp_get_max_threads() at construction, so async_set is only valid in
+  // teams no larger than that, and a thread past them that needs its cache throws out_of_range.
+  template <class R = typename Reducer<V>::Overwrite>
+  void async_set(const K& key, const size_t hash_value, const V& value, const R& reducer = R()) {
+    async_set_entry(key, hash_value, value, reducer);
+  }
+
+  // Moves the key and the value in if the key is new.
+  template <class R = typename Reducer<V>::Overwrite>
+  void async_set(K&& key, const size_t hash_value, V&& value, const R& reducer = R()) {
+    async_set_entry(std::move(key), hash_value, std::move(value), reducer);
+  }
+
+  // Moves the entries of the write combining buffers and the thread caches into the segments. Each
+  // segment is filled by one thread without locking, so no thread may use the map meanwhile. The
+  // entries meet the segments with reducer, so pass the reducer given to async_set, or a plain sync
+  // after async_set with Sum overwrites the sums instead of adding to them.
+  template <class R = typename Reducer<V>::Overwrite>
+  void sync(const R& reducer = R());
 
-  void async_set(
-      const K& key,
-      const size_t hash_value,
-      const V& value,
-      const std::function<void(V&, const V&)>& reducer = Reducer<V>::overwrite);
+  void unset(const K& key, const size_t hash_value) { unset<K>(key, hash_value); }
 
-  void sync(const std::function<void(V&, const V&)>& reducer = Reducer<V>::overwrite);
+  // Takes keys of other types when the hasher is transparent.
+  template <class KL, class = EnableIfLookupKey<K, KL, H>>
+  void unset(const KL& key, const size_t hash_value);
+
+  V get(const K& key, const size_t hash_value, const V& default_value = V()) {
+    return get<K>(key, hash_value, default_value);
+  }
 
-  void unset(const K& key, const size_t hash_value);
+  template <class KL, class = EnableIfLookupKey<K, KL, H>>
+  V get(const KL& key, const size_t hash_value, const V& default_value = V());
 
-  V get(const K& key, const size_t hash_value, const V& default_value = V());
+  // Looks up n_batch_keys keys grouped by segment, so each segment lock is taken once per batch.
+  void get_batch(
+      const K* keys,
+      const size_t* hash_values,
+      const size_t n_batch_keys,
+      V* values,
+      const V& default_value = V());
 
-  bool has(const K& key, const size_t hash_value);
+  bool has(const K& key, const size_t hash_value) { return has<K>(key, hash_value); }
+
+  template <class KL, class = EnableIfLookupKey<K, KL, H>>
+  bool has(const KL& key, const size_t hash_value);
+
+  void has_batch(
+      const K* keys, const size_t* hash_values, const size_t n_batch_keys, bool* results);
+
+  // Removes the entries for which predicate(const K& key, const V& value) is true, sweeping the
+  // segments in parallel. Thread caches are not visited, so sync first if async_set was used.
+  template <class F>
+  size_t erase_if(const F& predicate);
 
   void clear();
 
@@ -60,181 +153,612 @@ class BareConcurrentMap {
       const std::function<void(const K& key, const size_t hash_value, const V& value)>& handler,
       const bool verbose = false);
 
+  // Sets the entries of other with the reducer. When both maps have the same number of segments,
+  // the entries of a segment land in the same segment here, so segments are merged in parallel
+  // without locks and with the hash values already stored. No other thread may use either map
+  // meanwhile. Thread caches of other are not visited, so sync it first if async_set was used.
+  template <class A2, class CA2, class R = typename Reducer<V>::Overwrite>
+  void merge_from(const BareConcurrentMap<K, V, H, P, A2, CA2>& other, const R& reducer = R());
+
+  // Moves the entries out of other and clears it.
+  template <class A2, class CA2, class R = typename Reducer<V>::Overwrite>
+  void merge_from(BareConcurrentMap<K, V, H, P, A2, CA2>&& other, const R& reducer = R());
+
+  // Builds an immutable copy for lookups without locks, see BareFrozenMap. Thread caches are not
+  // included, so sync first if async_set was used, and no thread may write meanwhile.
+  template <class M = BareFrozenMap<K, V, H, A>>
+  M freeze() const {
+    M res;
+    res.build(segments);
+    return res;
+  }
+
  private:
   float max_load_factor;
 
   size_t n_segments;
 
-  std::vector<BareMap<K, V, H>> segments;
+  CacheLineVector<LockedSegment<BareMap<K, V, H, P, A>>> segments;
 
   size_t n_threads;
 
-  std::vector<BareMap<K, V, H>> thread_caches;
+  CacheLineVector<CacheLinePadded<BareMap<K, V, H, P, CA>>> thread_caches;
+
+  std::vector<SegmentBloomFilter> bloom_filters;
+
+  bool optimistic_reads;
+
+  size_t max_n_thread_cache_keys;
+
+  struct BufferedEntry {
+    K key;
+
+    size_t hash_value;
+
+    V value;
+  };
+
+  // Keys per write combining buffer, 0 if off.
+  size_t n_buffer_keys;
+
+  // For each thread, one write combining buffer per segment.
+  CacheLineVector<CacheLinePadded<std::vector<std::vector<BufferedEntry>>>> write_buffers;
+
+  // Scratch space of spill_thread_cache, kept per thread so that spills reuse their allocations.
+  struct SpillBuffer {
+    std::vector<K> keys;
+
+    std::vector<size_t> hash_values;
 
-  std::vector<omp_lock_t> segment_locks;
+    std::vector<V> values;
 
-  constexpr static size_t N_SEGMENTS_PER_THREAD = 8;
+    std::vector<size_t> order;
 
-  bool has_big_prime_factors(const int num);
+    std::vector<size_t> segment_starts;
+
+    std::vector<bool> spilled;
+  };
+
+  CacheLineVector<CacheLinePadded<SpillBuffer>> spill_buffers;
+
+  // Lookups without the lock retry this many times before taking it.
+  constexpr static int MAX_N_OPTIMISTIC_READS = 4;
+
+  template <class KF, class VF, class R>
+  void set_entry(KF&& key, const size_t hash_value, VF&& value, const R& reducer);
+
+  template <class KF, class VF, class R>
+  void async_set_entry(KF&& key, const size_t hash_value, VF&& value, const R& reducer);
+
+  // Moves the entries of a write combining buffer into its segment and empties it.
+  template <class R>
+  void flush_write_buffer(
+      const size_t segment_id, std::vector<BufferedEntry>& buffer, const R& reducer);
+
+  // Moves the entries of a buffer into segment_id without locking and empties it.
+  template <class R>
+  void merge_buffer(const size_t segment_id, std::vector<BufferedEntry>& buffer, const R& reducer);
+
+  // Moves the entries of the thread cache into the segments, see set_max_n_thread_cache_keys.
+  template <class R>
+  void spill_thread_cache(const int thread_id, const R& reducer);
+
+  // Sets an entry into segment_id without locking, for merges.
+  template <class KF, class VF, class R>
+  void merge_entry(
+      const size_t segment_id, KF&& key, const size_t hash_value, VF&& value, const R& reducer);
+
+  template <class, class, class, class, class, class>
+  friend class BareConcurrentMap;
+
+  // Sorts the batch indices by segment. The indices of segment i end up in
+  // order[segment_starts[i], segment_starts[i + 1]).
+  void group_by_segment(
+      const size_t* hash_values,
+      const size_t n_batch_keys,
+      std::vector<size_t>& order,
+      std::vector<size_t>& segment_starts) const;
+
+  // Frees the tables kept for optimistic reads. No lookup may run concurrently.
+  void release_replaced_tables();
 };
 
-template <class K, class V, class H>
-BareConcurrentMap<K, V, H>::BareConcurrentMap() {
-  max_load_factor = BareMap<K, V, H>::DEFAULT_MAX_LOAD_FACTOR;
+template <class K, class V, class H, class P, class A, class CA>
+BareConcurrentMap<K, V, H, P, A, CA>::BareConcurrentMap(const size_t n_segments) {
+  if (n_segments == 0) throw std::invalid_argument("N segments must be positive.");
+  max_load_factor = BareMap<K, V, H, P, A>::DEFAULT_MAX_LOAD_FACTOR;
   n_threads = omp_get_max_threads();
   thread_caches.resize(n_threads);
-  if (!has_big_prime_factors(n_threads)) {
-    throw std::invalid_argument("N threads has big prime factors, which affects performance.");
-  }
-  n_segments = n_threads * N_SEGMENTS_PER_THREAD;
+  spill_buffers.resize(n_threads);
+  this->n_segments = n_segments;
   segments.resize(n_segments);
-  segment_locks.resize(n_segments);
-  for (auto& lock : segment_locks) omp_init_lock(&lock);
+  bloom_filters.resize(n_segments);
+  optimistic_reads = false;
+  max_n_thread_cache_keys = std::numeric_limits<size_t>::max();
+  n_buffer_keys = 0;
 }
 
-template <class K, class V, class H>
-BareConcurrentMap<K, V, H>::BareConcurrentMap(const BareConcurrentMap& m) {
+template <class K, class V, class H, class P, class A, class CA>
+BareConcurrentMap<K, V, H, P, A, CA>::BareConcurrentMap(const BareConcurrentMap& m) {
   max_load_factor = m.max_load_factor;
   n_threads = omp_get_max_threads();
   thread_caches.resize(n_threads);
+  spill_buffers.resize(n_threads);
   n_segments = m.n_segments;
   segments = m.segments;
-  segment_locks.resize(n_segments);
-  for (auto& lock : segment_locks) omp_init_lock(&lock);
-}
-
-template <class K, class V, class H>
-BareConcurrentMap<K, V, H>::~BareConcurrentMap() {
-  for (auto& lock : segment_locks) omp_destroy_lock(&lock);
+  bloom_filters.reserve(n_segments);
+  for (size_t i = 0; i < n_segments; i++) {
+    bloom_filters.push_back(m.bloom_filters[i]);
+    bloom_filters[i].reset(segments[i]);
+  }
+  optimistic_reads = m.optimistic_reads;
+  max_n_thread_cache_keys = m.max_n_thread_cache_keys;
+  n_buffer_keys = 0;
+  set_write_combining(m.n_buffer_keys);
+  release_replaced_tables();
 }
 
-template <class K, class V, class H>
-void BareConcurrentMap<K, V, H>::reserve(const size_t n_keys_min) {
+template <class K, class V, class H, class P, class A, class CA>
+void BareConcurrentMap<K, V, H, P, A, CA>::reserve(const size_t n_keys_min) {
   const size_t n_segment_keys_min = n_keys_min / n_segments;
   for (size_t i = 0; i < n_segments; i++) segments.at(i).reserve(n_segment_keys_min);
   const size_t n_thread_keys_est = n_keys_min / 1000;
   for (size_t i = 0; i < n_threads; i++) thread_caches.at(i).reserve(n_thread_keys_est);
 };
 
-template <class K, class V, class H>
-void BareConcurrentMap<K, V, H>::set_max_load_factor(const float max_load_factor) {
+template <class K, class V, class H, class P, class A, class CA>
+void BareConcurrentMap<K, V, H, P, A, CA>::set_max_load_factor(const float max_load_factor) {
   this->max_load_factor = max_load_factor;
   for (size_t i = 0; i < n_segments; i++) segments.at(i).max_load_factor = max_load_factor;
   for (size_t i = 0; i < n_threads; i++) thread_caches.at(i).max_load_factor = max_load_factor;
 }
 
-template <class K, class V, class H>
-size_t BareConcurrentMap<K, V, H>::get_n_keys() const {
+template <class K, class V, class H, class P, class A, class CA>
+void BareConcurrentMap<K, V, H, P, A, CA>::set_bloom_filter(const bool enabled) {
+#pragma omp parallel for schedule(dynamic, 1)
+  for (size_t i = 0; i < n_segments; i++) bloom_filters[i].set_enabled(enabled, segments[i]);
+}
+
+template <class K, class V, class H, class P, class A, class CA>
+void BareConcurrentMap<K, V, H, P, A, CA>::set_optimistic_reads(const bool enabled) {
+  optimistic_reads = enabled && BareMap<K, V, H, P, A>::OPTIMISTIC_READS;
+  for (auto& segment : segments) segment.set_keep_replaced_tables(optimistic_reads);
+}
+
+template <class K, class V, class H, class P, class A, class CA>
+void BareConcurrentMap<K, V, H, P, A, CA>::set_max_n_thread_cache_keys(
+    const size_t max_n_thread_cache_keys) {
+  this->max_n_thread_cache_keys = std::max<size_t>(max_n_thread_cache_keys, 1);
+}
+
+template <class K, class V, class H, class P, class A, class CA>
+void BareConcurrentMap<K, V, H, P, A, CA>::set_write_combining(const size_t n_buffer_keys) {
+  this->n_buffer_keys = n_buffer_keys;
+  write_buffers.clear();
+  if (n_buffer_keys == 0) return;
+  write_buffers.resize(n_threads);
+  for (auto& thread_buffers : write_buffers) {
+    thread_buffers.resize(n_segments);
+    for (auto& buffer : thread_buffers) buffer.reserve(n_buffer_keys);
+  }
+}
+
+template <class K, class V, class H, class P, class A, class CA>
+void BareConcurrentMap<K, V, H, P, A, CA>::set_thread_cache_budget(const size_t n_bytes) {
+  // Tables hold at least max_load_factor / 2 keys per bucket, since they double when full.
+  const float n_bytes_per_key = 2 * (sizeof(HashEntry<K, V, H>) + 1) / max_load_factor;
+  set_max_n_thread_cache_keys(n_bytes / n_threads / n_bytes_per_key);
+}
+
+template <class K, class V, class H, class P, class A, class CA>
+size_t BareConcurrentMap<K, V, H, P, A, CA>::get_n_keys() const {
   size_t n_keys = 0;
   for (size_t i = 0; i < n_segments; i++) n_keys += segments.at(i).get_n_keys();
   return n_keys;
 }
 
-template <class K, class V, class H>
-size_t BareConcurrentMap<K, V, H>::get_n_buckets() const {
+template <class K, class V, class H, class P, class A, class CA>
+size_t BareConcurrentMap<K, V, H, P, A, CA>::get_n_buckets() const {
   size_t n_buckets = 0;
   for (size_t i = 0; i < n_segments; i++) n_buckets += segments.at(i).get_n_buckets();
   return n_buckets;
 }
 
-template <class K, class V, class H>
-void BareConcurrentMap<K, V, H>::async_set(
-    const K& key,
-    const size_t hash_value,
-    const V& value,
-    const std::function<void(V&, const V&)>& reducer) {
-  const size_t segment_id = hash_value % n_segments;
-  auto& lock = segment_locks[segment_id];
-  if (omp_test_lock(&lock)) {
-    segments.at(segment_id).set(key, hash_value, value, reducer);
-    omp_unset_lock(&lock);
+template <class K, class V, class H, class P, class A, class CA>
+template <class KF, class VF, class R>
+void BareConcurrentMap<K, V, H, P, A, CA>::async_set_entry(
+    KF&& key, const size_t hash_value, VF&& value, const R& reducer) {
+  const size_t segment_id = get_segment_id(hash_value, n_segments);
+  if (n_buffer_keys > 0) {
+    auto& buffer = write_buffers.at(omp_get_thread_num())[segment_id];
+    buffer.push_back(BufferedEntry{std::forward<KF>(key), hash_value, std::forward<VF>(value)});
+    if (buffer.size() >= n_buffer_keys) flush_write_buffer(segment_id, buffer, reducer);
+    return;
+  }
+  auto& segment = segments[segment_id];
+  if (segment.try_lock()) {
+    segment.set(std::forward<KF>(key), hash_value, std::forward<VF>(value), reducer);
+    bloom_filters[segment_id].insert(hash_value, segment);
+    segment.unlock();
   } else {
     const int thread_id = omp_get_thread_num();
-    thread_caches.at(thread_id).set(key, hash_value, value, reducer);
+    auto& thread_cache = thread_caches.at(thread_id);
+    thread_cache.set(std::forward<KF>(key), hash_value, std::forward<VF>(value), reducer);
+    if (thread_cache.get_n_keys() >= max_n_thread_cache_keys) {
+      spill_thread_cache(thread_id, reducer);
+    }
   }
 }
 
-template <class K, class V, class H>
-void BareConcurrentMap<K, V, H>::sync(const std::function<void(V&, const V&)>& reducer) {
+template <class K, class V, class H, class P, class A, class CA>
+template <class R>
+void BareConcurrentMap<K, V, H, P, A, CA>::flush_write_buffer(
+    const size_t segment_id, std::vector<BufferedEntry>& buffer, const R& reducer) {
+  auto& segment = segments[segment_id];
+  segment.lock();
+  merge_buffer(segment_id, buffer, reducer);
+  segment.unlock();
+}
+
+template <class K, class V, class H, class P, class A, class CA>
+template <class R>
+void BareConcurrentMap<K, V, H, P, A, CA>::merge_buffer(
+    const size_t segment_id, std::vector<BufferedEntry>& buffer, const R& reducer) {
+  constexpr size_t PREFETCH_DISTANCE = BareMap<K, V, H, P, A>::BATCH_PREFETCH_DISTANCE;
+  const size_t n_buffered_keys = buffer.size();
+  auto& segment = segments[segment_id];
+  for (size_t i = 0; i < n_buffered_keys && i < PREFETCH_DISTANCE; i++) {
+    segment.prefetch(buffer[i].hash_value);
+  }
+  for (size_t i = 0; i < n_buffered_keys; i++) {
+    if (i + PREFETCH_DISTANCE < n_buffered_keys) {
+      segment.prefetch(buffer[i + PREFETCH_DISTANCE].hash_value);
+    }
+    auto& entry = buffer[i];
+    segment.set(std::move(entry.key), entry.hash_value, std::move(entry.value), reducer);
+    bloom_filters[segment_id].insert(entry.hash_value, segment);
+  }
+  buffer.clear();
+}
+
+template <class K, class V, class H, class P, class A, class CA>
+template <class R>
+void BareConcurrentMap<K, V, H, P, A, CA>::spill_thread_cache(
+    const int thread_id, const R& reducer) {
+  auto& thread_cache = thread_caches[thread_id];
+  const size_t n_cached_keys = thread_cache.get_n_keys();
+  auto& spill_buffer = spill_buffers[thread_id];
+  auto& keys = spill_buffer.keys;
+  auto& hash_values = spill_buffer.hash_values;
+  auto& values = spill_buffer.values;
+  auto& order = spill_buffer.order;
+  auto& segment_starts = spill_buffer.segment_starts;
+  auto& spilled = spill_buffer.spilled;
+  thread_cache.drain([&](K&& key, const size_t hash_value, V&& value) {
+    keys.push_back(std::move(key));
+    hash_values.push_back(hash_value);
+    values.push_back(std::move(value));
+  });
+  group_by_segment(hash_values.data(), n_cached_keys, order, segment_starts);
+
+  // Take the free segments first, then wait for the busy ones only if too much is left.
+  spilled.assign(n_segments, false);
+  size_t n_left_keys = n_cached_keys;
+  for (int pass = 0; pass < 2 && n_left_keys > 0; pass++) {
+    const bool wait = pass == 1;
+    if (wait && n_left_keys <= max_n_thread_cache_keys / 2) break;
+    for (size_t segment_id = 0; segment_id < n_segments; segment_id++) {
+      const size_t begin = segment_starts[segment_id];
+      const size_t end = segment_starts[segment_id + 1];
+      if (begin == end || spilled[segment_id]) continue;
+      auto& segment = segments[segment_id];
+      if (wait) {
+        segment.lock();
+      } else if (!segment.try_lock()) {
+        continue;
+      }
+      for (size_t j = begin; j < end; j++) {
+        const size_t i = order[j];
+        segment.set(std::move(keys[i]), hash_values[i], std::move(values[i]), reducer);
+        bloom_filters[segment_id].insert(hash_values[i], segment);
+      }
+      segment.unlock();
+      spilled[segment_id] = true;
+      n_left_keys -= end - begin;
+    }
+  }
+  if (n_left_keys > 0) {
+    for (size_t segment_id = 0; segment_id < n_segments; segment_id++) {
+      if (spilled[segment_id]) continue;
+      for (size_t j = segment_starts[segment_id]; j < segment_starts[segment_id + 1]; j++) {
+        const size_t i = order[j];
+        thread_cache.set(std::move(keys[i]), hash_values[i], std::move(values[i]), reducer);
+      }
+    }
+  }
+  keys.clear();
+  hash_values.clear();
+  values.clear();
+}
+
+template <class K, class V, class H, class P, class A, class CA>
+template <class R>
+void BareConcurrentMap<K, V, H, P, A, CA>::sync(const R& reducer) {
+  // Each thread first groups the buckets of its cache by segment, keeping only their ids. Then a
+  // single thread takes each segment and moves in the entries all the threads have for it without
+  // locking, largest segments first, and idle threads take the next segment, so no thread waits on
+  // another's lock or large cache.
+  std::vector<std::vector<size_t>> cache_bucket_ids(n_threads);
+  std::vector<std::vector<size_t>> cache_segment_starts(n_threads);
+  std::vector<size_t> segment_n_keys(n_segments, 0);
+  std::vector<size_t> segment_order(n_segments);
+  const auto& get_cache_segment_id = [&](const size_t hash_value) {
+    return get_segment_id(hash_value, n_segments);
+  };
 #pragma omp parallel
   {
-    const int thread_id = omp_get_thread_num();
-    const auto& handler = [&](const K& key, const size_t hash_value, const V& value) {
-      const size_t segment_id = hash_value % n_segments;
-      auto& lock = segment_locks[segment_id];
-      omp_set_lock(&lock);
-      segments.at(segment_id).set(key, hash_value, value, reducer);
-      omp_unset_lock(&lock);
-    };
-    thread_caches.at(thread_id).for_each(handler);
-    thread_caches.at(thread_id).clear();
-  }
-}
-
-template <class K, class V, class H>
-void BareConcurrentMap<K, V, H>::set(
-    const K& key,
-    const size_t hash_value,
-    const V& value,
-    const std::function<void(V&, const V&)>& reducer) {
-  const size_t segment_id = hash_value % n_segments;
-  auto& lock = segment_locks[segment_id];
-  omp_set_lock(&lock);
-  segments.at(segment_id).set(key, hash_value, value, reducer);
-  omp_unset_lock(&lock);
-}
-
-template <class K, class V, class H>
-V BareConcurrentMap<K, V, H>::get(const K& key, const size_t hash_value, const V& default_value) {
-  const size_t segment_id = hash_value % n_segments;
-  auto& lock = segment_locks[segment_id];
-  omp_set_lock(&lock);
-  V res = segments.at(segment_id).get(key, hash_value, default_value);
-  omp_unset_lock(&lock);
+    // The caches are split over whatever team runs here, which need not have n_threads threads.
+#pragma omp for schedule(dynamic, 1)
+    for (size_t i = 0; i < n_threads; i++) {
+      thread_caches[i].group_buckets(
+          get_cache_segment_id, n_segments, cache_bucket_ids[i], cache_segment_starts[i]);
+    }
+#pragma omp single
+    {
+      for (size_t i = 0; i < n_threads; i++) {
+        const auto& segment_starts = cache_segment_starts[i];
+        if (!segment_starts.empty()) {
+          for (size_t j = 0; j < n_segments; j++) {
+            segment_n_keys[j] += segment_starts[j + 1] - segment_starts[j];
+          }
+        }
+        if (n_buffer_keys == 0) continue;
+        for (size_t j = 0; j < n_segments; j++) segment_n_keys[j] += write_buffers[i][j].size();
+      }
+      std::iota(segment_order.begin(), segment_order.end(), 0);
+      std::stable_sort(segment_order.begin(), segment_order.end(), [&](size_t a, size_t b) {
+        return segment_n_keys[a] > segment_n_keys[b];
+      });
+    }
+#pragma omp for schedule(dynamic, 1)
+    for (size_t j = 0; j < n_segments; j++) {
+      const size_t segment_id = segment_order[j];
+      if (segment_n_keys[segment_id] == 0) continue;
+      auto& segment = segments[segment_id];
+      const auto& handler = [&](K&& key, const size_t hash_value, V&& value) {
+        segment.set(std::move(key), hash_value, std::move(value), reducer);
+        bloom_filters[segment_id].insert(hash_value, segment);
+      };
+      for (size_t i = 0; i < n_threads; i++) {
+        if (n_buffer_keys > 0) merge_buffer(segment_id, write_buffers[i][segment_id], reducer);
+        const auto& segment_starts = cache_segment_starts[i];
+        if (segment_starts.empty()) continue;
+        for (size_t k = segment_starts[segment_id]; k < segment_starts[segment_id + 1]; k++) {
+          thread_caches[i].take_bucket(cache_bucket_ids[i][k], handler);
+        }
+      }
+    }
+#pragma omp for schedule(dynamic, 1)
+    for (size_t i = 0; i < n_threads; i++) thread_caches[i].clear();
+  }
+  release_replaced_tables();
+}
+
+template <class K, class V, class H, class P, class A, class CA>
+template <class A2, class CA2, class R>
+void BareConcurrentMap<K, V, H, P, A, CA>::merge_from(
+    const BareConcurrentMap<K, V, H, P, A2, CA2>& other, const R& reducer) {
+  const bool aligned = other.n_segments == n_segments;
+#pragma omp parallel for schedule(dynamic, 1)
+  for (size_t i = 0; i < other.n_segments; i++) {
+    other.segments[i].for_each([&](const K& key, const size_t hash_value, const V& value) {
+      if (aligned) {
+        merge_entry(i, key, hash_value, value, reducer);
+      } else {
+        set_entry(key, hash_value, value, reducer);
+      }
+    });
+  }
+}
+
+template <class K, class V, class H, class P, class A, class CA>
+template <class A2, class CA2, class R>
+void BareConcurrentMap<K, V, H, P, A, CA>::merge_from(
+    BareConcurrentMap<K, V, H, P, A2, CA2>&& other, const R& reducer) {
+  const bool aligned = other.n_segments == n_segments;
+#pragma omp parallel for schedule(dynamic, 1)
+  for (size_t i = 0; i < other.n_segments; i++) {
+    other.segments[i].drain([&](K&& key, const size_t hash_value, V&& value) {
+      if (aligned) {
+        merge_entry(i, std::move(key), hash_value, std::move(value), reducer);
+      } else {
+        set_entry(std::move(key), hash_value, std::move(value), reducer);
+      }
+    });
+  }
+  other.clear();
+}
+
+template <class K, class V, class H, class P, class A, class CA>
+template <class KF, class VF, class R>
+void BareConcurrentMap<K, V, H, P, A, CA>::merge_entry(
+    const size_t segment_id, KF&& key, const size_t hash_value, VF&& value, const R& reducer) {
+  segments[segment_id].set(std::forward<KF>(key), hash_value, std::forward<VF>(value), reducer);
+  bloom_filters[segment_id].insert(hash_value, segments[segment_id]);
+}
+
+template <class K, class V, class H, class P, class A, class CA>
+template <class KF, class VF, class R>
+void BareConcurrentMap<K, V, H, P, A, CA>::set_entry(
+    KF&& key, const size_t hash_value, VF&& value, const R& reducer) {
+  const size_t segment_id = get_segment_id(hash_value, n_segments);
+  auto& segment = segments[segment_id];
+  segment.lock();
+  segment.set(std::forward<KF>(key), hash_value, std::forward<VF>(value), reducer);
+  bloom_filters[segment_id].insert(hash_value, segment);
+  segment.unlock();
+}
+
+template <class K, class V, class H, class P, class A, class CA>
+template <class KL, class>
+V BareConcurrentMap<K, V, H, P, A, CA>::get(
+    const KL& key, const size_t hash_value, const V& default_value) {
+  const size_t segment_id = get_segment_id(hash_value, n_segments);
+  if (!bloom_filters[segment_id].may_contain(hash_value)) return default_value;
+  auto& segment = segments[segment_id];
+  if (BareMap<K, V, H, P, A>::OPTIMISTIC_READS && optimistic_reads) {
+    for (int i = 0; i < MAX_N_OPTIMISTIC_READS; i++) {
+      const uint64_t read_seq = segment.begin_read();
+      const auto& validate = [&]() { return segment.validate_read(read_seq); };
+      V res;
+      if (segment.get_optimistic(key, hash_value, default_value, res, validate) && validate()) {
+        return res;
+      }
+    }
+  }
+  segment.lock();
+  V res = segment.get(key, hash_value, default_value);
+  segment.unlock();
   return res;
 }
 
-template <class K, class V, class H>
-void BareConcurrentMap<K, V, H>::unset(const K& key, const size_t hash_value) {
-  const size_t segment_id = hash_value % n_segments;
-  auto& lock = segment_locks[segment_id];
-  omp_set_lock(&lock);
-  segments.at(segment_id).unset(key, hash_value);
-  omp_unset_lock(&lock);
+template <class K, class V, class H, class P, class A, class CA>
+void BareConcurrentMap<K, V, H, P, A, CA>::get_batch(
+    const K* keys,
+    const size_t* hash_values,
+    const size_t n_batch_keys,
+    V* values,
+    const V& default_value) {
+  constexpr size_t PREFETCH_DISTANCE = BareMap<K, V, H, P, A>::BATCH_PREFETCH_DISTANCE;
+  std::vector<size_t> order;
+  std::vector<size_t> segment_starts;
+  group_by_segment(hash_values, n_batch_keys, order, segment_starts);
+  for (size_t segment_id = 0; segment_id < n_segments; segment_id++) {
+    const size_t begin = segment_starts[segment_id];
+    const size_t end = segment_starts[segment_id + 1];
+    if (begin == end) continue;
+    auto& segment = segments[segment_id];
+    segment.lock();
+    for (size_t j = begin; j < end && j < begin + PREFETCH_DISTANCE; j++) {
+      segment.prefetch(hash_values[order[j]]);
+    }
+    for (size_t j = begin; j < end; j++) {
+      if (j + PREFETCH_DISTANCE < end) segment.prefetch(hash_values[order[j + PREFETCH_DISTANCE]]);
+      const size_t i = order[j];
+      values[i] = segment.get(keys[i], hash_values[i], default_value);
+    }
+    segment.unlock();
+  }
+}
+
+template <class K, class V, class H, class P, class A, class CA>
+template <class KL, class>
+void BareConcurrentMap<K, V, H, P, A, CA>::unset(const KL& key, const size_t hash_value) {
+  const size_t segment_id = get_segment_id(hash_value, n_segments);
+  if (!bloom_filters[segment_id].may_contain(hash_value)) return;
+  auto& segment = segments[segment_id];
+  segment.lock();
+  segment.unset(key, hash_value);
+  segment.unlock();
 }
 
-template <class K, class V, class H>
-bool BareConcurrentMap<K, V, H>::has(const K& key, const size_t hash_value) {
-  const size_t segment_id = hash_value % n_segments;
-  auto& lock = segment_locks[segment_id];
-  omp_set_lock(&lock);
-  bool res = segments.at(segment_id).has(key, hash_value);
-  omp_unset_lock(&lock);
+template <class K, class V, class H, class P, class A, class CA>
+template <class KL, class>
+bool BareConcurrentMap<K, V, H, P, A, CA>::has(const KL& key, const size_t hash_value) {
+  const size_t segment_id = get_segment_id(hash_value, n_segments);
+  if (!bloom_filters[segment_id].may_contain(hash_value)) return false;
+  auto& segment = segments[segment_id];
+  if (BareMap<K, V, H, P, A>::OPTIMISTIC_READS && optimistic_reads) {
+    for (int i = 0; i < MAX_N_OPTIMISTIC_READS; i++) {
+      const uint64_t read_seq = segment.begin_read();
+      const auto& validate = [&]() { return segment.validate_read(read_seq); };
+      bool res;
+      if (segment.has_optimistic(key, hash_value, res, validate) && validate()) return res;
+    }
+  }
+  segment.lock();
+  bool res = segment.has(key, hash_value);
+  segment.unlock();
   return res;
 }
 
-template <class K, class V, class H>
-void BareConcurrentMap<K, V, H>::clear() {
-  for (size_t i = 0; i < n_segments; i++) segments.at(i).clear();
+template <class K, class V, class H, class P, class A, class CA>
+void BareConcurrentMap<K, V, H, P, A, CA>::has_batch(
+    const K* keys, const size_t* hash_values, const size_t n_batch_keys, bool* results) {
+  constexpr size_t PREFETCH_DISTANCE = BareMap<K, V, H, P, A>::BATCH_PREFETCH_DISTANCE;
+  std::vector<size_t> order;
+  std::vector<size_t> segment_starts;
+  group_by_segment(hash_values, n_batch_keys, order, segment_starts);
+  for (size_t segment_id = 0; segment_id < n_segments; segment_id++) {
+    const size_t begin = segment_starts[segment_id];
+    const size_t end = segment_starts[segment_id + 1];
+    if (begin == end) continue;
+    auto& segment = segments[segment_id];
+    segment.lock();
+    for (size_t j = begin; j < end && j < begin + PREFETCH_DISTANCE; j++) {
+      segment.prefetch(hash_values[order[j]]);
+    }
+    for (size_t j = begin; j < end; j++) {
+      if (j + PREFETCH_DISTANCE < end) segment.prefetch(hash_values[order[j + PREFETCH_DISTANCE]]);
+      const size_t i = order[j];
+      results[i] = segment.has(keys[i], hash_values[i]);
+    }
+    segment.unlock();
+  }
+}
+
+template <class K, class V, class H, class P, class A, class CA>
+template <class F>
+size_t BareConcurrentMap<K, V, H, P, A, CA>::erase_if(const F& predicate) {
+  size_t n_erased = 0;
+#pragma omp parallel for schedule(dynamic, 1) reduction(+ : n_erased)
+  for (size_t i = 0; i < n_segments; i++) {
+    auto& segment = segments[i];
+    segment.lock();
+    n_erased += segment.erase_if(predicate);
+    segment.unlock();
+  }
+  return n_erased;
+}
+
+template <class K, class V, class H, class P, class A, class CA>
+void BareConcurrentMap<K, V, H, P, A, CA>::clear() {
+  for (size_t i = 0; i < n_segments; i++) {
+    segments.at(i).clear();
+    bloom_filters[i].reset(segments[i]);
+  }
   for (size_t i = 0; i < n_threads; i++) thread_caches.at(i).clear();
+  for (auto& thread_buffers : write_buffers) {
+    for (auto& buffer : thread_buffers) buffer.clear();
+  }
+  release_replaced_tables();
 }
 
-template <class K, class V, class H>
-void BareConcurrentMap<K, V, H>::clear_and_shrink() {
-  for (size_t i = 0; i < n_segments; i++) segments.at(i).clear_and_shrink();
+template <class K, class V, class H, class P, class A, class CA>
+void BareConcurrentMap<K, V, H, P, A, CA>::clear_and_shrink() {
+  for (size_t i = 0; i < n_segments; i++) {
+    segments.at(i).clear_and_shrink();
+    bloom_filters[i].reset(segments[i]);
+  }
   for (size_t i = 0; i < n_threads; i++) thread_caches.at(i).clear_and_shrink();
+  for (auto& thread_buffers : write_buffers) {
+    for (auto& buffer : thread_buffers) buffer.clear();
+  }
+  spill_buffers.clear();
+  spill_buffers.resize(n_threads);
+  release_replaced_tables();
 }
 
-template <class K, class V, class H>
-std::string BareConcurrentMap<K, V, H>::to_string() {
+template <class K, class V, class H, class P, class A, class CA>
+std::string BareConcurrentMap<K, V, H, P, A, CA>::to_string() {
   std::vector<std::string> ostrs(n_segments);
   size_t total_size = 0;
 #pragma omp parallel for
   for (size_t i = 0; i < n_segments; i++) {
-    auto& lock = segment_locks[i];
-    omp_set_lock(&lock);
-    hps::serialize_to_string(segments.at(i), ostrs.at(i));
-    omp_unset_lock(&lock);
+    auto& segment = segments[i];
+    segment.lock();
+    hps::serialize_to_string(segment.get_table(), ostrs.at(i));
+    segment.unlock();
 #pragma omp atomic
     total_size += ostrs[i].size();
   }
@@ -242,6 +766,7 @@ std::string BareConcurrentMap<K, V, H>::to_string() {
   str.reserve(total_size + n_segments * 8);
   hps::OutputBuffer<std::string> ob_str(str);
   hps::Serializer<float, std::string>::serialize(max_load_factor, ob_str);
+  hps::Serializer<size_t, std::string>::serialize(n_segments, ob_str);
   for (size_t i = 0; i < n_segments; i++) {
     hps::Serializer<std::string, std::string>::serialize(ostrs[i], ob_str);
   }
@@ -249,47 +774,79 @@ std::string BareConcurrentMap<K, V, H>::to_string() {
   return str;
 }
 
-template <class K, class V, class H>
-void BareConcurrentMap<K, V, H>::from_string(const std::string& str) {
-  std::vector<std::string> istrs(n_segments);
+template <class K, class V, class H, class P, class A, class CA>
+void BareConcurrentMap<K, V, H, P, A, CA>::from_string(const std::string& str) {
   hps::InputBuffer<std::string> ib_str(str);
   hps::Serializer<float, std::string>::parse(max_load_factor, ib_str);
-  for (size_t i = 0; i < n_segments; i++) {
+  size_t n_str_segments;
+  hps::Serializer<size_t, std::string>::parse(n_str_segments, ib_str);
+  std::vector<std::string> istrs(n_str_segments);
+  for (size_t i = 0; i < n_str_segments; i++) {
     hps::Serializer<std::string, std::string>::parse(istrs[i], ib_str);
   }
+  if (n_str_segments != n_segments) {
+    // Written with another number of segments, so the entries are spread over the segments again.
+    clear();
+#pragma omp parallel for schedule(dynamic, 1)
+    for (size_t i = 0; i < n_str_segments; i++) {
+      BareMap<K, V, H, P, A> segment;
+      hps::parse_from_string(segment, istrs[i]);
+      segment.drain([&](K&& key, const size_t hash_value, V&& value) {
+        set_entry(std::move(key), hash_value, std::move(value), typename Reducer<V>::Overwrite());
+      });
+    }
+    release_replaced_tables();
+    return;
+  }
 #pragma omp parallel for
   for (size_t i = 0; i < n_segments; i++) {
-    auto& lock = segment_locks[i];
-    omp_set_lock(&lock);
-    hps::parse_from_string(segments.at(i), istrs[i]);
-    omp_unset_lock(&lock);
+    auto& segment = segments[i];
+    segment.lock();
+    hps::parse_from_string(segment.get_table(), istrs[i]);
+    bloom_filters[i].reset(segment);
+    segment.unlock();
   }
+  release_replaced_tables();
 }
 
-template <class K, class V, class H>
-void BareConcurrentMap<K, V, H>::for_each(
+template <class K, class V, class H, class P, class A, class CA>
+void BareConcurrentMap<K, V, H, P, A, CA>::for_each(
     const std::function<void(const K& key, const size_t hash_value, const V& value)>& handler,
     const bool verbose) {
 #pragma omp parallel for schedule(static, 1)
   for (size_t i = 0; i < n_segments; i++) {
     segments.at(i).for_each(handler);
     if (verbose && omp_get_thread_num() == 0) {
-      printf("%zu/%zu ", i / n_threads, N_SEGMENTS_PER_THREAD);
+      printf("%zu/%zu ", i / n_threads, (n_segments + n_threads - 1) / n_threads);
     }
   }
   if (verbose) printf("#\n");
 }
 
-template <class K, class V, class H>
-bool BareConcurrentMap<K, V, H>::has_big_prime_factors(const int num) {
-  constexpr int SMALL_PRIMES[] = {2, 3, 5, 7};
-  constexpr int N_SMALL_PRIMES = sizeof(SMALL_PRIMES) / sizeof(int);
-  int remain = num;
-  for (int i = 0; i < N_SMALL_PRIMES; i++) {
-    const int prime = SMALL_PRIMES[i];
-    while (remain % prime == 0) remain /= prime;
+template <class K, class V, class H, class P, class A, class CA>
+void BareConcurrentMap<K, V, H, P, A, CA>::group_by_segment(
+    const size_t* hash_values,
+    const size_t n_batch_keys,
+    std::vector<size_t>& order,
+    std::vector<size_t>& segment_starts) const {
+  // segment_starts[i + 1] serves as the cursor of segment i, so that no other buffer is needed,
+  // and ends up at the end of segment i, which is the start of segment i + 1.
+  segment_starts.assign(n_segments + 1, 0);
+  for (size_t i = 0; i < n_batch_keys; i++) {
+    const size_t segment_id = get_segment_id(hash_values[i], n_segments);
+    if (segment_id + 2 <= n_segments) segment_starts[segment_id + 2]++;
   }
-  return remain == 1;
+  std::partial_sum(segment_starts.begin(), segment_starts.end(), segment_starts.begin());
+  order.resize(n_batch_keys);
+  for (size_t i = 0; i < n_batch_keys; i++) {
+    order[segment_starts[get_segment_id(hash_values[i], n_segments) + 1]++] = i;
+  }
+}
+
+template <class K, class V, class H, class P, class A, class CA>
+void BareConcurrentMap<K, V, H, P, A, CA>::release_replaced_tables() {
+  if (!optimistic_reads) return;
+  for (auto& segment : segments) segment.release_replaced_tables();
 }
 
 }  // namespace hpmr
@@ -1,8 +1,11 @@
 #include "bare_concurrent_map.h"
 
 #include <gtest/gtest.h>
+#include <omp.h>
+#include <memory>
 #include <string>
 #include <unordered_map>
+#include "pool_allocator.h"
 #include "reducer.h"
 
 TEST(BareConcurrentMapTest, Initialization) {
@@ -62,6 +65,27 @@ TEST(BareConcurrentMapTest, SetAndGet) {
   EXPECT_EQ(m.get("cc", hasher("cc")), 3);
 }
 
+TEST(BareConcurrentMapTest, GetAndHasBatch) {
+  hpmr::BareConcurrentMap<int, int> m;
+  constexpr int N_KEYS = 10000;
+  std::hash<int> hasher;
+  for (int i = 0; i < N_KEYS; i += 2) m.set(i, hasher(i), i * 3);
+  std::vector<int> keys(N_KEYS);
+  std::vector<size_t> hash_values(N_KEYS);
+  for (int i = 0; i < N_KEYS; i++) {
+    keys[i] = N_KEYS - 1 - i;
+    hash_values[i] = hasher(keys[i]);
+  }
+  std::vector<int> values(N_KEYS);
+  m.get_batch(keys.data(), hash_values.data(), N_KEYS, values.data(), -1);
+  std::unique_ptr<bool[]> results(new bool[N_KEYS]);
+  m.has_batch(keys.data(), hash_values.data(), N_KEYS, results.get());
+  for (int i = 0; i < N_KEYS; i++) {
+    EXPECT_EQ(values[i], keys[i] % 2 == 0 ? keys[i] * 3 : -1);
+    EXPECT_EQ(results[i], keys[i] % 2 == 0);
+  }
+}
+
 TEST(BareConcurrentMapTest, LargeParallelSetIndependentSTLComparison) {
   const int n_threads = omp_get_max_threads();
   std::unordered_map<std::string, int> m[n_threads];
@@ -104,6 +128,115 @@ TEST(BareConcurrentMapTest, LargeParallelAsyncSet) {
   EXPECT_GE(m.get_n_buckets(), N_KEYS);
 }
 
+TEST(BareConcurrentMapTest, BoundedThreadCaches) {
+  // One segment, so that threads often find it locked and fill their caches.
+  hpmr::BareConcurrentMap<int, int> m(1);
+  m.set_max_n_thread_cache_keys(8);
+  hpmr::Hash<int> hasher;
+  constexpr int N_KEYS = 1000;
+  constexpr int N_REPEATS = 100;
+#pragma omp parallel for
+  for (int i = 0; i < N_KEYS * N_REPEATS; i++) {
+    const int key = i % N_KEYS;
+    m.async_set(key, hasher(key), 1, hpmr::Reducer<int>::Sum());
+  }
+  m.sync(hpmr::Reducer<int>::Sum());
+  EXPECT_EQ(m.get_n_keys(), N_KEYS);
+  for (int i = 0; i < N_KEYS; i++) EXPECT_EQ(m.get(i, hasher(i)), N_REPEATS);
+
+  hpmr::BareConcurrentMap<int, int> m2;
+  m2.set_thread_cache_budget(1 << 20);
+  m2.async_set(1, hasher(1), 2);
+  m2.sync();
+  EXPECT_EQ(m2.get(1, hasher(1)), 2);
+}
+
+TEST(BareConcurrentMapTest, WriteCombining) {
+  hpmr::BareConcurrentMap<std::string, int> m;
+  m.set_write_combining(16);
+  std::hash<std::string> hasher;
+  constexpr int N_KEYS = 10000;
+  constexpr int N_REPEATS = 10;
+#pragma omp parallel for
+  for (int i = 0; i < N_KEYS * N_REPEATS; i++) {
+    const auto& key = std::to_string(i % N_KEYS);
+    m.async_set(key, hasher(key), 1, hpmr::Reducer<int>::Sum());
+  }
+  m.sync(hpmr::Reducer<int>::Sum());
+  EXPECT_EQ(m.get_n_keys(), N_KEYS);
+  for (int i = 0; i < N_KEYS; i++) {
+    const auto& key = std::to_string(i);
+    EXPECT_EQ(m.get(key, hasher(key)), N_REPEATS);
+  }
+
+  // Buffers that are not full wait for sync.
+  hpmr::BareConcurrentMap<std::string, int> m2(m);
+  m2.clear();
+  m2.async_set("aa", hasher("aa"), 1);
+  EXPECT_FALSE(m2.has("aa", hasher("aa")));
+  m2.sync();
+  EXPECT_EQ(m2.get("aa", hasher("aa")), 1);
+}
+
+TEST(BareConcurrentMapTest, SyncContendedSegments) {
+  // Few segments for many threads, so that most entries wait in the thread caches for sync.
+  hpmr::BareConcurrentMap<int, int> m(2);
+  hpmr::Hash<int> hasher;
+  constexpr int N_KEYS = 1000;
+  constexpr int N_REPEATS = 100;
+#pragma omp parallel for schedule(static, 1)
+  for (int i = 0; i < N_KEYS * N_REPEATS; i++) {
+    const int key = i % N_KEYS;
+    m.async_set(key, hasher(key), 1, hpmr::Reducer<int>::Sum());
+  }
+  m.sync(hpmr::Reducer<int>::Sum());
+  EXPECT_EQ(m.get_n_keys(), N_KEYS);
+  for (int i = 0; i < N_KEYS; i++) EXPECT_EQ(m.get(i, hasher(i)), N_REPEATS);
+}
+
+TEST(BareConcurrentMapTest, SyncInAnyTeamSize) {
+  hpmr::BareConcurrentMap<int, int> m(2);
+  hpmr::Hash<int> hasher;
+  constexpr int N_KEYS = 1000;
+  const int n_threads = omp_get_max_threads();
+  // Syncs in a team smaller than the one that filled the caches, then in a larger one.
+  for (const int n_sync_threads : {1, n_threads * 2}) {
+#pragma omp parallel for schedule(static, 1)
+    for (int i = 0; i < N_KEYS; i++) m.async_set(i, hasher(i), 1, hpmr::Reducer<int>::Sum());
+    omp_set_num_threads(n_sync_threads);
+    m.sync(hpmr::Reducer<int>::Sum());
+    omp_set_num_threads(n_threads);
+  }
+  EXPECT_EQ(m.get_n_keys(), N_KEYS);
+  for (int i = 0; i < N_KEYS; i++) EXPECT_EQ(m.get(i, hasher(i)), 2);
+}
+
+TEST(BareConcurrentMapTest, PoolAllocatedThreadCaches) {
+  hpmr::BareConcurrentMap<
+      std::string,
+      int,
+      std::hash<std::string>,
+      hpmr::PrimeBucketPolicy,
+      std::allocator<char>,
+      hpmr::PoolAllocator<char>>
+      m;
+  std::hash<std::string> hasher;
+  constexpr int N_KEYS = 100000;
+  for (int round = 0; round < 2; round++) {
+#pragma omp parallel for
+    for (int i = 0; i < N_KEYS; i++) {
+      const auto& key = std::to_string(i);
+      m.async_set(key, hasher(key), i, hpmr::Reducer<int>::sum);
+    }
+    m.sync(hpmr::Reducer<int>::sum);
+  }
+  EXPECT_EQ(m.get_n_keys(), N_KEYS);
+  for (int i = 0; i < N_KEYS; i += 1000) {
+    const auto& key = std::to_string(i);
+    EXPECT_EQ(m.get(key, hasher(key)), i * 2);
+  }
+}
+
 TEST(BareConcurrentMapTest, UnsetAndHas) {
   hpmr::BareConcurrentMap<std::string, int> m;
   std::hash<std::string> hasher;
@@ -161,3 +294,114 @@ TEST(BareConcurrentMapTest, ToAndFromString) {
   EXPECT_EQ(m2.get("aa", hasher("aa")), 1);
   EXPECT_EQ(m2.get("bbb", hasher("bbb")), 2);
 }
+
+TEST(BareConcurrentMapTest, AnyNumberOfSegments) {
+  constexpr int N_KEYS = 10000;
+  hpmr::BareConcurrentMap<int, int> m1(3);
+  EXPECT_EQ(m1.get_n_segments(), 3);
+  hpmr::Hash<int> hasher;
+#pragma omp parallel for
+  for (int i = 0; i < N_KEYS; i++) m1.async_set(i, hasher(i), i);
+  m1.sync();
+  EXPECT_EQ(m1.get_n_keys(), N_KEYS);
+  for (int i = 0; i < N_KEYS; i++) EXPECT_EQ(m1.get(i, hasher(i)), i);
+
+  // Strings from maps with other numbers of segments are spread over the segments again.
+  hpmr::BareConcurrentMap<int, int> m2(44);
+  m2.set(-1, hasher(-1), -1);
+  m2.from_string(m1.to_string());
+  EXPECT_EQ(m2.get_n_keys(), N_KEYS);
+  EXPECT_FALSE(m2.has(-1, hasher(-1)));
+  for (int i = 0; i < N_KEYS; i++) EXPECT_EQ(m2.get(i, hasher(i)), i);
+
+  const size_t n_segments = hpmr::BareConcurrentMap<int, int>::get_default_n_segments(1ULL << 32);
+  EXPECT_EQ(n_segments & (n_segments - 1), 0);
+  EXPECT_GE(n_segments, 1 << 12);
+}
+
+TEST(BareConcurrentMapTest, OptimisticReads) {
+  constexpr int N_KEYS = 200000;
+  // Few segments so that rehashes overlap the reads.
+  hpmr::BareConcurrentMap<int, int> m(2);
+  m.set_optimistic_reads(true);
+  hpmr::Hash<int> hasher;
+  int n_wrong = 0;
+#pragma omp parallel reduction(+ : n_wrong)
+  {
+    if (omp_get_thread_num() == 0) {
+      for (int i = 0; i < N_KEYS; i++) m.set(i, hasher(i), i * 2);
+    } else {
+      for (int i = 0; i < N_KEYS; i++) {
+        const int value = m.get(i, hasher(i), -1);
+        if (value != -1 && value != i * 2) n_wrong++;
+        if (m.has(i, hasher(i)) && m.get(i, hasher(i), -1) != i * 2) n_wrong++;
+      }
+    }
+  }
+  EXPECT_EQ(n_wrong, 0);
+  m.sync();
+  for (int i = 0; i < N_KEYS; i++) EXPECT_EQ(m.get(i, hasher(i), -1), i * 2);
+  EXPECT_FALSE(m.has(-1, hasher(-1)));
+
+  // Keys that are not trivially copyable keep taking the lock.
+  hpmr::BareConcurrentMap<std::string, int> m2;
+  std::hash<std::string> str_hasher;
+  m2.set_optimistic_reads(true);
+  m2.set("aa", str_hasher("aa"), 1);
+  EXPECT_EQ(m2.get("aa", str_hasher("aa")), 1);
+}
+
+TEST(BareConcurrentMapTest, EraseIf) {
+  hpmr::BareConcurrentMap<int, int> m;
+  hpmr::Hash<int> hasher;
+  constexpr int N_KEYS = 100000;
+#pragma omp parallel for
+  for (int i = 0; i < N_KEYS; i++) m.async_set(i, hasher(i), i);
+  m.sync();
+  EXPECT_EQ(m.erase_if([](const int, const int value) { return value % 4 != 0; }), N_KEYS / 4 * 3);
+  EXPECT_EQ(m.get_n_keys(), N_KEYS / 4);
+  for (int i = 0; i < N_KEYS; i++) EXPECT_EQ(m.has(i, hasher(i)), i % 4 == 0);
+}
+
+TEST(BareConcurrentMapTest, BloomFilter) {
+  hpmr::BareConcurrentMap<int, int> m;
+  hpmr::Hash<int> hasher;
+  constexpr int N_KEYS = 300000;
+  m.set(0, hasher(0), 0);
+  m.set_bloom_filter(true);
+#pragma omp parallel for
+  for (int i = 0; i < N_KEYS; i += 2) m.async_set(i, hasher(i), i);
+  m.sync();
+  for (int i = 0; i < N_KEYS; i++) EXPECT_EQ(m.has(i, hasher(i)), i % 2 == 0);
+  for (int i = 0; i < N_KEYS; i += 4) m.unset(i, hasher(i));
+  for (int i = 0; i < N_KEYS; i++) EXPECT_EQ(m.get(i, hasher(i), -1), i % 4 == 2 ? i : -1);
+  const auto m2 = m;
+  m.clear();
+  for (int i = 0; i < N_KEYS; i += 1000) EXPECT_FALSE(m.has(i, hasher(i)));
+  EXPECT_EQ(m2.get_n_keys(), N_KEYS / 4);
+}
+
+TEST(BareConcurrentMapTest, MergeFrom) {
+  hpmr::BareConcurrentMap<std::string, int> m1;
+  hpmr::BareConcurrentMap<std::string, int> m2;
+  std::hash<std::string> hasher;
+  constexpr int N_KEYS = 100000;
+#pragma omp parallel for
+  for (int i = 0; i < N_KEYS; i++) {
+    const auto& key = std::to_string(i);
+    m1.set(key, hasher(key), i);
+    if (i % 2 == 0) m2.set(key, hasher(key), 1);
+  }
+  m2.set("x", hasher("x"), 1);
+  m1.merge_from(m2, hpmr::Reducer<int>::Sum());
+  EXPECT_EQ(m1.get_n_keys(), N_KEYS + 1);
+  EXPECT_EQ(m2.get_n_keys(), N_KEYS / 2 + 1);
+  m1.merge_from(std::move(m2), hpmr::Reducer<int>::Sum());
+  EXPECT_EQ(m2.get_n_keys(), 0);
+  EXPECT_EQ(m1.get_n_keys(), N_KEYS + 1);
+  EXPECT_EQ(m1.get("x", hasher("x")), 2);
+  for (int i = 0; i < N_KEYS; i++) {
+    const auto& key = std::to_string(i);
+    EXPECT_EQ(m1.get(key, hasher(key)), i % 2 == 0 ? i + 2 : i);
+  }
+}
@@ -1,65 +1,124 @@
 #pragma once
 
+#include <algorithm>
 #include <functional>
+#include <numeric>
+#include <vector>
 #include "bare_concurrent_container.h"
 #include "bare_set.h"
 
 namespace hpmr {
-template <class K, class H = std::hash<K>>
-class BareConcurrentSet : public BareConcurrentContainer<K, void, BareSet<K, H>, H> {
+template <
+    class K,
+    class H = Hash<K>,
+    class P = PrimeBucketPolicy,
+    class A = std::allocator<char>,
+    class CA = A>
+class BareConcurrentSet
+    : public BareConcurrentContainer<K, void, BareSet<K, H, P, A>, H, BareSet<K, H, P, CA>> {
  public:
+  using BareConcurrentContainer<K, void, BareSet<K, H, P, A>, H, BareSet<K, H, P, CA>>::
+      BareConcurrentContainer;
+
   void set(const K& key, const size_t hash_value);
 
+  // See BareConcurrentMap::async_set, including the limit on the team size.
   void async_set(const K& key, const size_t hash_value);
 
+  // Moves the keys of the thread caches into the segments. Each segment is filled by one thread
+  // without locking, so no thread may use the set meanwhile.
   void sync();
 
  protected:
-  using BareConcurrentContainer<K, void, BareSet<K, H>, H>::n_segments;
+  using BareConcurrentContainer<K, void, BareSet<K, H, P, A>, H, BareSet<K, H, P, CA>>::n_segments;
+
+  using BareConcurrentContainer<K, void, BareSet<K, H, P, A>, H, BareSet<K, H, P, CA>>::segments;
 
-  using BareConcurrentContainer<K, void, BareSet<K, H>, H>::segments;
+  using BareConcurrentContainer<K, void, BareSet<K, H, P, A>, H, BareSet<K, H, P, CA>>::
+      thread_caches;
 
-  using BareConcurrentContainer<K, void, BareSet<K, H>, H>::segment_locks;
+  using BareConcurrentContainer<K, void, BareSet<K, H, P, A>, H, BareSet<K, H, P, CA>>::
+      bloom_filters;
 
-  using BareConcurrentContainer<K, void, BareSet<K, H>, H>::thread_caches;
+  using BareConcurrentContainer<K, void, BareSet<K, H, P, A>, H, BareSet<K, H, P, CA>>::n_threads;
 };
 
-template <class K, class H>
-void BareConcurrentSet<K, H>::set(const K& key, const size_t hash_value) {
-  const size_t segment_id = hash_value % n_segments;
-  auto& lock = segment_locks[segment_id];
-  omp_set_lock(&lock);
-  segments.at(segment_id).set(key, hash_value);
-  omp_unset_lock(&lock);
+template <class K, class H, class P, class A, class CA>
+void BareConcurrentSet<K, H, P, A, CA>::set(const K& key, const size_t hash_value) {
+  const size_t segment_id = get_segment_id(hash_value, n_segments);
+  auto& segment = segments[segment_id];
+  segment.lock();
+  segment.set(key, hash_value);
+  bloom_filters[segment_id].insert(hash_value, segment);
+  segment.unlock();
 }
 
-template <class K, class H>
-void BareConcurrentSet<K, H>::async_set(const K& key, const size_t hash_value) {
-  const size_t segment_id = hash_value % n_segments;
-  auto& lock = segment_locks[segment_id];
-  if (omp_test_lock(&lock)) {
-    segments.at(segment_id).set(key, hash_value);
-    omp_unset_lock(&lock);
+template <class K, class H, class P, class A, class CA>
+void BareConcurrentSet<K, H, P, A, CA>::async_set(const K& key, const size_t hash_value) {
+  const size_t segment_id = get_segment_id(hash_value, n_segments);
+  auto& segment = segments[segment_id];
+  if (segment.try_lock()) {
+    segment.set(key, hash_value);
+    bloom_filters[segment_id].insert(hash_value, segment);
+    segment.unlock();
   } else {
     const int thread_id = omp_get_thread_num();
     thread_caches.at(thread_id).set(key, hash_value);
   }
 }
 
-template <class K, class H>
-void BareConcurrentSet<K, H>::sync() {
+template <class K, class H, class P, class A, class CA>
+void BareConcurrentSet<K, H, P, A, CA>::sync() {
+  // Groups the buckets of the caches by segment, then fills each segment from one thread, see
+  // BareConcurrentMap::sync.
+  std::vector<std::vector<size_t>> cache_bucket_ids(n_threads);
+  std::vector<std::vector<size_t>> cache_segment_starts(n_threads);
+  std::vector<size_t> segment_n_keys(n_segments, 0);
+  std::vector<size_t> segment_order(n_segments);
+  const auto& get_cache_segment_id = [&](const size_t hash_value) {
+    return get_segment_id(hash_value, n_segments);
+  };
 #pragma omp parallel
   {
-    const int thread_id = omp_get_thread_num();
-    const auto& handler = [&](const K& key, const size_t hash_value) {
-      const size_t segment_id = hash_value % n_segments;
-      auto& lock = segment_locks[segment_id];
-      omp_set_lock(&lock);
-      segments.at(segment_id).set(key, hash_value);
-      omp_unset_lock(&lock);
-    };
-    thread_caches.at(thread_id).for_each(handler);
-    thread_caches.at(thread_id).clear();
+    // The caches are split over whatever team runs here, which need not have n_threads threads.
+#pragma omp for schedule(dynamic, 1)
+    for (size_t i = 0; i < n_threads; i++) {
+      thread_caches[i].group_buckets(
+          get_cache_segment_id, n_segments, cache_bucket_ids[i], cache_segment_starts[i]);
+    }
+#pragma omp single
+    {
+      for (size_t i = 0; i < n_threads; i++) {
+        const auto& segment_starts = cache_segment_starts[i];
+        if (segment_starts.empty()) continue;
+        for (size_t j = 0; j < n_segments; j++) {
+          segment_n_keys[j] += segment_starts[j + 1] - segment_starts[j];
+        }
+      }
+      std::iota(segment_order.begin(), segment_order.end(), 0);
+      std::stable_sort(segment_order.begin(), segment_order.end(), [&](size_t a, size_t b) {
+        return segment_n_keys[a] > segment_n_keys[b];
+      });
+    }
+#pragma omp for schedule(dynamic, 1)
+    for (size_t j = 0; j < n_segments; j++) {
+      const size_t segment_id = segment_order[j];
+      if (segment_n_keys[segment_id] == 0) continue;
+      auto& segment = segments[segment_id];
+      const auto& handler = [&](K&& key, const size_t hash_value) {
+        segment.set(std::move(key), hash_value);
+        bloom_filters[segment_id].insert(hash_value, segment);
+      };
+      for (size_t i = 0; i < n_threads; i++) {
+        const auto& segment_starts = cache_segment_starts[i];
+        if (segment_starts.empty()) continue;
+        for (size_t k = segment_starts[segment_id]; k < segment_starts[segment_id + 1]; k++) {
+          thread_caches[i].take_bucket(cache_bucket_ids[i][k], handler);
+        }
+      }
+    }
+#pragma omp for schedule(dynamic, 1)
+    for (size_t i = 0; i < n_threads; i++) thread_caches[i].clear();
   }
 }
-}  // namespace hpmr
\ No newline at end of file
+}  // namespace hpmr
@@ -1,6 +1,7 @@
 #include "bare_concurrent_set.h"
 
 #include <gtest/gtest.h>
+#include <omp.h>
 #include <string>
 #include <unordered_set>
 #include "reducer.h"
@@ -102,6 +103,25 @@ TEST(BareConcurrentSetTest, LargeParallelAsyncSet) {
   EXPECT_GE(m.get_n_buckets(), N_KEYS);
 }
 
+TEST(BareConcurrentSetTest, SyncInAnyTeamSize) {
+  hpmr::BareConcurrentSet<int> m(2);
+  hpmr::Hash<int> hasher;
+  constexpr int N_KEYS = 1000;
+  const int n_threads = omp_get_max_threads();
+  // Syncs in a team smaller than the one that filled the caches, then in a larger one.
+  for (const int n_sync_threads : {1, n_threads * 2}) {
+#pragma omp parallel for schedule(static, 1)
+    for (int i = 0; i < N_KEYS; i++) {
+      const int key = i + N_KEYS * n_sync_threads;
+      m.async_set(key, hasher(key));
+    }
+    omp_set_num_threads(n_sync_threads);
+    m.sync();
+    omp_set_num_threads(n_threads);
+  }
+  EXPECT_EQ(m.get_n_keys(), N_KEYS * 2);
+}
+
 TEST(BareConcurrentSetTest, UnsetAndHas) {
   hpmr::BareConcurrentSet<std::string> m;
   std::hash<std::string> hasher;
@@ -159,3 +179,26 @@ TEST(BareConcurrentSetTest, ToAndFromString) {
   EXPECT_TRUE(m2.has("aa", hasher("aa")));
   EXPECT_TRUE(m2.has("bbb", hasher("bbb")));
 }
+
+TEST(BareConcurrentSetTest, AnyNumberOfSegments) {
+  constexpr int N_KEYS = 10000;
+  hpmr::BareConcurrentSet<int> m1(3);
+  EXPECT_EQ(m1.get_n_segments(), 3);
+  hpmr::Hash<int> hasher;
+#pragma omp parallel for
+  for (int i = 0; i < N_KEYS; i++) m1.async_set(i, hasher(i));
+  m1.sync();
+  EXPECT_EQ(m1.get_n_keys(), N_KEYS);
+  for (int i = 0; i < N_KEYS; i++) EXPECT_TRUE(m1.has(i, hasher(i)));
+
+  // Strings from sets with other numbers of segments are spread over the segments again.
+  hpmr::BareConcurrentSet<int> m2(44);
+  m2.set(-1, hasher(-1));
+  m2.from_string(m1.to_string());
+  EXPECT_EQ(m2.get_n_keys(), N_KEYS);
+  EXPECT_FALSE(m2.has(-1, hasher(-1)));
+  for (int i = 0; i < N_KEYS; i++) EXPECT_TRUE(m2.has(i, hasher(i)));
+
+  hpmr::BareConcurrentSet<int> m3;
+  EXPECT_EQ(m3.get_n_segments(), hpmr::BareConcurrentSet<int>::get_default_n_segments());
+}
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <omp.h>
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+#include "hash.h"
+#include "hash_entry.h"
+
+namespace hpmr {
+// An immutable map for the read phase after a concurrent map is synced, which requires providing
+// hash values when use. Keys and values are stored in two arrays without empty buckets or control
+// bytes, ordered by group, and each key hashes to one group of about GROUP_SIZE keys, so a lookup
+// reads two group offsets and scans a few adjacent keys. Lookups take no locks and any number of
+// threads may run them at once.
+template <class K, class V, class H = Hash<K>, class A = std::allocator<char>>
+class BareFrozenMap {
+ public:
+  // Groups hold between GROUP_SIZE / 2 and GROUP_SIZE keys on average.
+  constexpr static size_t GROUP_SIZE = 4;
+
+  BareFrozenMap();
+
+  // Builds from partitions, in which partition i holds the keys whose hash values have segment id i
+  // among the partitions (see get_segment_id), like the segments of BareConcurrentMap. Partitions
+  // are read with get_n_keys, for_each_hash_value and for_each, one thread each.
+  template <class M, class MA>
+  void build(const std::vector<M, MA>& partitions);
+
+  size_t get_n_keys() const { return keys.size(); }
+
+  V get(const K& key, const size_t hash_value, const V& default_value = V()) const {
+    return get<K>(key, hash_value, default_value);
+  }
+
+  // Takes keys of other types when the hasher is transparent.
+  template <class KL, class = EnableIfLookupKey<K, KL, H>>
+  V get(const KL& key, const size_t hash_value, const V& default_value = V()) const {
+    const size_t key_id = find(key, hash_value);
+    return key_id == NOT_FOUND ? default_value : values[key_id];
+  }
+
+  bool has(const K& key, const size_t hash_value) const { return has<K>(key, hash_value); }
+
+  template <class KL, class = EnableIfLookupKey<K, KL, H>>
+  bool has(const KL& key, const size_t hash_value) const {
+    return find(key, hash_value) != NOT_FOUND;
+  }
+
+  void for_each(const std::function<void(const K& key, const V& value)>& handler) const;
+
+ protected:
+  template <class T>
+  using Vector = std::vector<T, typename std::allocator_traits<A>::template rebind_alloc<T>>;
+
+  constexpr static size_t NOT_FOUND = std::numeric_limits<size_t>::max();
+
+  size_t n_partitions;
+
+  // Groups per partition, a power of two.
+  size_t n_partition_groups;
+
+  // Index of the first key of each partition, followed by the number of keys.
+  Vector<size_t> partition_begins;
+
+  // For each partition, n_partition_groups + 1 offsets of the groups from the partition begin.
+  Vector<uint32_t> group_begins;
+
+  Vector<K> keys;
+
+  Vector<V> values;
+
+  size_t get_partition_id(const size_t hash_value) const {
+    return get_segment_id(hash_value, n_partitions);
+  }
+
+  // Index of the group within its partition, from bits independent of the partition id.
+  size_t get_partition_group_id(const size_t hash_value) const {
+    return mix_hash(hash_value) & (n_partition_groups - 1);
+  }
+
+  template <class KL>
+  size_t find(const KL& key, const size_t hash_value) const;
+};
+
+template <class K, class V, class H, class A>
+BareFrozenMap<K, V, H, A>::BareFrozenMap() {
+  n_partitions = 1;
+  n_partition_groups = 1;
+  partition_begins.assign(2, 0);
+  group_begins.assign(2, 0);
+}
+
+template <class K, class V, class H, class A>
+template <class M, class MA>
+void BareFrozenMap<K, V, H, A>::build(const std::vector<M, MA>& partitions) {
+  n_partitions = std::max<size_t>(partitions.size(), 1);
+  partition_begins.assign(n_partitions + 1, 0);
+  size_t max_n_partition_keys = 0;
+  for (size_t i = 0; i < partitions.size(); i++) {
+    const size_t n_partition_keys = partitions[i].get_n_keys();
+    partition_begins[i + 1] = partition_begins[i] + n_partition_keys;
+    max_n_partition_keys = std::max(max_n_partition_keys, n_partition_keys);
+  }
+  if (max_n_partition_keys > std::numeric_limits<uint32_t>::max()) {
+    throw std::length_error("Too many keys in a partition to freeze.");
+  }
+  n_partition_groups = 1;
+  while (n_partition_groups * GROUP_SIZE < max_n_partition_keys) n_partition_groups <<= 1;
+  const size_t n_group_begins = n_partition_groups + 1;
+  group_begins.assign(n_partitions * n_group_begins, 0);
+  keys.resize(partition_begins[n_partitions]);
+  values.resize(partition_begins[n_partitions]);
+
+#pragma omp parallel for schedule(dynamic, 1)
+  for (size_t i = 0; i < partitions.size(); i++) {
+    uint32_t* partition_group_begins = group_begins.data() + i * n_group_begins;
+    partitions[i].for_each_hash_value([&](const size_t hash_value) {
+      partition_group_begins[get_partition_group_id(hash_value) + 1]++;
+    });
+    for (size_t j = 0; j < n_partition_groups; j++) {
+      partition_group_begins[j + 1] += partition_group_begins[j];
+    }
+    std::vector<uint32_t> cursors(
+        partition_group_begins, partition_group_begins + n_partition_groups);
+    const size_t partition_begin = partition_begins[i];
+    partitions[i].for_each([&](const K& key, const size_t hash_value, const V& value) {
+      const size_t key_id = partition_begin + cursors[get_partition_group_id(hash_value)]++;
+      keys[key_id] = key;
+      values[key_id] = value;
+    });
+  }
+}
+
+template <class K, class V, class H, class A>
+template <class KL>
+size_t BareFrozenMap<K, V, H, A>::find(const KL& key, const size_t hash_value) const {
+  const size_t partition_id = get_partition_id(hash_value);
+  const size_t partition_begin = partition_begins[partition_id];
+  const uint32_t* partition_group_begins =
+      group_begins.data() + partition_id * (n_partition_groups + 1);
+  const size_t group_id = get_partition_group_id(hash_value);
+  const size_t end = partition_begin + partition_group_begins[group_id + 1];
+  for (size_t i = partition_begin + partition_group_begins[group_id]; i < end; i++) {
+    if (keys[i] == key) return i;
+  }
+  return NOT_FOUND;
+}
+
+template <class K, class V, class H, class A>
+void BareFrozenMap<K, V, H, A>::for_each(
+    const std::function<void(const K& key, const V& value)>& handler) const {
+  const size_t n_keys = keys.size();
+  for (size_t i = 0; i < n_keys; i++) handler(keys[i], values[i]);
+}
+}  // namespace hpmr
@@ -1,22 +1,56 @@
 #pragma once
 
+#include <omp.h>
 #include <cassert>
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <type_traits>
 #include <vector>
+#include "bucket_policy.h"
+#include "control_group.h"
+#include "hash.h"
 #include "hash_entry.h"
 #include "hash_entry_serializer.h"
 #include "reducer.h"
 
 namespace hpmr {
 // A linear probing hash container as the base of hash map or set.
-template <class K, class V, class H = std::hash<K>>
+// The bucket policy P decides the bucket counts and how hash values map to buckets.
+// Probing scans a separate array of one byte control tags a group at a time and only touches the
+// entries whose tags match. With a Robin Hood bucket policy the control bytes hold probe distances.
+// With an incremental rehash bucket policy the table grows a few buckets at a time, and until it is
+// done the entries not moved yet stay in the old buckets. Entries of keys that are cheap to hash
+// recompute their hash values with H if H is a ComputedHash, so hash values passed in must match H
+// in that case, see StoreHashValue.
+// The bucket and control byte arrays are allocated with the allocator A rebound to their types.
+// Rehashing a large table outside of a parallel region spreads the entries over all the threads.
+// When probes get long in a sparse table, the hash values are remixed with a random seed and the
+// table is rehashed, which breaks up clusters from weak hashers or adversarial keys.
+// Concurrent containers may look keys up while a writer changes the table, see has_optimistic, in
+// which case the tables replaced by rehashes are kept until release_replaced_tables.
+template <
+    class K,
+    class V,
+    class H = Hash<K>,
+    class P = PrimeBucketPolicy,
+    class A = std::allocator<char>>
 class BareHashContainer {
  public:
   constexpr static float DEFAULT_MAX_LOAD_FACTOR = 0.7;
 
-  constexpr static size_t N_INITIAL_BUCKETS = 11;
-
   constexpr static size_t MAX_N_PROBES = 64;
 
+  // Hash values that still collide after this many seeds at the same table size are not worth
+  // another rehash.
+  constexpr static int MAX_N_RESEEDS = 8;
+
+  // How many keys ahead batch lookups prefetch the home buckets.
+  constexpr static size_t BATCH_PREFETCH_DISTANCE = 8;
+
+  // Tables with fewer buckets are rehashed by the calling thread alone.
+  constexpr static size_t PARALLEL_REHASH_MIN_BUCKETS = 1 << 18;
+
   float max_load_factor;
 
   BareHashContainer();
@@ -29,9 +63,77 @@ class BareHashContainer {
 
   void reserve_n_buckets(const size_t n_buckets_min);
 
-  void unset(const K& key, const size_t hash_value);
+  void unset(const K& key, const size_t hash_value) { unset<K>(key, hash_value); }
+
+  // Takes keys of other types when the hasher is transparent.
+  template <class KL, class = EnableIfLookupKey<K, KL, H>>
+  void unset(const KL& key, const size_t hash_value);
+
+  bool has(const K& key, const size_t hash_value) const { return has<K>(key, hash_value); }
+
+  template <class KL, class = EnableIfLookupKey<K, KL, H>>
+  bool has(const KL& key, const size_t hash_value) const;
+
+  // Looks up n_batch_keys keys and writes whether each exists to results.
+  void has_batch(
+      const K* keys, const size_t* hash_values, const size_t n_batch_keys, bool* results) const;
+
+  // Prefetches the control bytes and the entry of the home bucket of the hash value.
+  void prefetch(const size_t hash_value) const {
+    const size_t bucket_id = get_bucket_id(hash_value);
+    __builtin_prefetch(ctrl.data() + bucket_id);
+    __builtin_prefetch(buckets.data() + bucket_id);
+  }
+
+  // Whether lookups may read the table while another thread writes it. Torn keys and values are
+  // harmless then, as long as the caller discards the results a writer overlapped.
+  constexpr static bool OPTIMISTIC_READS = std::is_trivially_copyable<HashEntry<K, V, H>>::value;
+
+  // Looks the key up while other threads may be writing the table, for concurrent containers that
+  // detect writers with a sequence lock. validate() is called once the table header is read and
+  // must return whether no writer ran since the read began. Returns false if the lookup has to
+  // retry, otherwise sets found, which is only valid if no writer ran until the caller checks
+  // again. Requires OPTIMISTIC_READS and the replaced tables kept.
+  template <class KL, class F>
+  bool has_optimistic(
+      const KL& key, const size_t hash_value, bool& found, const F& validate) const {
+    const TableView table = get_table_view();
+    if (!validate() || table.has_old_buckets) return false;
+    size_t bucket_id;
+    size_t n_probes;
+    found = probe(table, key, hash_value, bucket_id, n_probes);
+    return true;
+  }
+
+  // Keeps the arrays replaced by rehashes until release_replaced_tables, so that optimistic
+  // lookups never read freed memory. The replaced arrays of a growing table take about as much
+  // memory as the current ones.
+  void set_keep_replaced_tables(const bool keep) {
+    keep_replaced_tables = keep;
+    if (!keep) release_replaced_tables();
+  }
+
+  // No optimistic lookup may run concurrently.
+  void release_replaced_tables() {
+    std::vector<Vector<HashEntry<K, V, H>>>().swap(replaced_buckets);
+    std::vector<Vector<uint8_t>>().swap(replaced_ctrl);
+  }
+
+  // Calls handler(hash_value) on each entry.
+  template <class F>
+  void for_each_hash_value(const F& handler) const {
+    for_each_entry([&](const HashEntry<K, V, H>& entry) { handler(entry.get_hash_value(hasher)); });
+  }
 
-  bool has(const K& key, const size_t hash_value) const;
+  // Lists the filled buckets grouped by get_group_id(hash_value) < n_groups: the ids of group g are
+  // bucket_ids[group_starts[g]] to bucket_ids[group_starts[g + 1] - 1]. The ids are valid until the
+  // next write, and can be read or taken from by other threads, one thread per bucket.
+  template <class F>
+  void group_buckets(
+      const F& get_group_id,
+      const size_t n_groups,
+      std::vector<size_t>& bucket_ids,
+      std::vector<size_t>& group_starts) const;
 
   void clear();
 
@@ -44,187 +146,781 @@ class BareHashContainer {
   void parse(hps::InputBuffer<B>& buf);
 
  protected:
+  template <class T>
+  using Vector = std::vector<T, typename std::allocator_traits<A>::template rebind_alloc<T>>;
+
   size_t n_keys;
 
   size_t n_buckets;
 
-  std::vector<HashEntry<K, V>> buckets;
+  H hasher;
+
+  Vector<HashEntry<K, V, H>> buckets;
+
+  // One control byte per bucket, followed by a copy of the first ControlGroup::SIZE - 1 bytes so
+  // that a group starting at any bucket can be loaded without wrapping around.
+  Vector<uint8_t> ctrl;
+
+  // The buckets of the table being grown incrementally, empty otherwise.
+  Vector<HashEntry<K, V, H>> old_buckets;
+
+  // The arrays and sizes a probe reads, so that lookups can run on a snapshot of them.
+  struct TableView {
+    const uint8_t* ctrl;
+
+    const HashEntry<K, V, H>* buckets;
+
+    size_t n_buckets;
+
+    size_t seed;
+
+    bool has_old_buckets;
+
+    size_t get_bucket_id(const size_t hash_value) const {
+      return P::get_bucket_id(seed == 0 ? hash_value : mix_hash(hash_value ^ seed), n_buckets);
+    }
+
+    size_t get_wrapped_bucket_id(size_t bucket_id) const {
+      while (bucket_id >= n_buckets) bucket_id -= n_buckets;
+      return bucket_id;
+    }
+  };
+
+  TableView get_table_view() const {
+    return TableView{ctrl.data(), buckets.data(), n_buckets, seed, !old_buckets.empty()};
+  }
 
   void check_balance(const size_t n_probes);
 
+  // Grows the table when it is too full, all at once or incrementally depending on the policy.
+  void grow();
+
+  // Calls handler on each filled entry, including the old ones not moved yet.
+  template <class F>
+  void for_each_entry(const F& handler) const;
+
+  // Calls handler on each filled entry, which it may move from, and clears the container.
+  template <class F>
+  void drain_entries(const F& handler);
+
+  // The entry of a bucket id from group_buckets, which counts the old buckets after the table.
+  HashEntry<K, V, H>& get_bucket_entry(const size_t bucket_id) {
+    return bucket_id < n_buckets ? buckets[bucket_id] : old_buckets[bucket_id - n_buckets];
+  }
+
+  // Removes the entries for which predicate(entry) is true and returns how many. The remaining
+  // entries of each cluster are moved back toward their home buckets in the same sweep, so no
+  // per entry backshift is needed.
+  template <class F>
+  size_t erase_entries_if(const F& predicate);
+
+  // Moves the next few old buckets to the table if an incremental rehash is in progress.
+  void rehash_step() {
+    if (P::N_REHASH_STEP_BUCKETS > 0 && !old_buckets.empty()) migrate(P::N_REHASH_STEP_BUCKETS);
+  }
+
+  // Returns whether the key exists. If so, bucket_id is where it is, otherwise bucket_id is where
+  // the key would be inserted. n_probes is the distance from the home bucket.
+  template <class KL>
+  bool probe(const KL& key, const size_t hash_value, size_t& bucket_id, size_t& n_probes) const {
+    return probe(get_table_view(), key, hash_value, bucket_id, n_probes);
+  }
+
+  template <class KL>
+  bool probe(
+      const TableView& table,
+      const KL& key,
+      const size_t hash_value,
+      size_t& bucket_id,
+      size_t& n_probes) const;
+
+  // Prepares the insert position from probe() for a new entry and sets its control byte.
+  // Returns the bucket to fill, which moves if the table has to grow to make room.
+  size_t claim_bucket(size_t bucket_id, size_t n_probes, const size_t hash_value);
+
+  // Returns whether the key is among the old buckets not moved yet. If so, old_bucket_id is where.
+  template <class KL>
+  bool probe_old(const KL& key, const size_t hash_value, size_t& old_bucket_id) const;
+
+  void set_ctrl(const size_t bucket_id, const uint8_t ctrl_byte);
+
+  size_t get_bucket_id(const size_t hash_value) const {
+    return P::get_bucket_id(get_seeded_hash_value(hash_value), n_buckets);
+  }
+
+  size_t get_next_bucket_id(const size_t bucket_id) const {
+    return P::get_next_bucket_id(bucket_id, n_buckets);
+  }
+
  private:
   bool unbalanced_warned;
 
-  size_t get_n_rehash_buckets(const size_t n_buckets_min);
+  // Zero until the table is reseeded, so that hash values map to buckets directly.
+  size_t seed;
+
+  // Reseeds since the table last changed size.
+  int n_reseeds;
+
+  // Control bytes of the old buckets. Moved and unset entries are marked DELETED instead of EMPTY,
+  // so the old probe sequences stay intact.
+  Vector<uint8_t> old_ctrl;
+
+  size_t n_migrated_buckets;
+
+  bool keep_replaced_tables;
+
+  std::vector<Vector<HashEntry<K, V, H>>> replaced_buckets;
+
+  std::vector<Vector<uint8_t>> replaced_ctrl;
 
   void rehash(const size_t n_rehash_buckets);
+
+  // Rehashes into the same number of buckets with a new random seed.
+  void reseed();
+
+  size_t get_seeded_hash_value(const size_t hash_value) const {
+    return seed == 0 ? hash_value : mix_hash(hash_value ^ seed);
+  }
+
+  // Swaps in the new buckets and keeps the current ones as the old buckets.
+  void begin_rehash(const size_t n_rehash_buckets);
+
+  // Moves up to n_migrate_buckets old buckets to the table and frees them once all are moved.
+  void migrate(size_t n_migrate_buckets);
+
+  // Moves all the old buckets to the table, with all the threads if the table is large.
+  void migrate_all();
+
+  // Moves all the old buckets to the table with all the threads and frees them.
+  void migrate_parallel();
+
+  void release_old_buckets();
+
+  // Inserts an entry whose key is known to be absent.
+  void insert(HashEntry<K, V, H>&& entry);
+
+  void reset_ctrl();
+
+  // Calls handler(bucket_id, hash_value) on each filled bucket, with the ids of group_buckets.
+  template <class F>
+  void for_each_bucket_hash_value(const F& handler) const;
+
+  // Writes the filled flag of each bucket followed by its entry if filled.
+  template <class B>
+  static void serialize_buckets(
+      const Vector<HashEntry<K, V, H>>& table_buckets,
+      const Vector<uint8_t>& table_ctrl,
+      hps::OutputBuffer<B>& buf);
+
+  template <class KL>
+  bool probe_robin_hood(
+      const TableView& table,
+      const KL& key,
+      const size_t hash_value,
+      size_t& bucket_id,
+      size_t& n_probes) const;
+
+  // Finds where a new entry goes, for a key known to be absent.
+  size_t find_insert_bucket_id(const size_t hash_value, size_t& n_probes) const;
+
+  // Moves the run of entries starting at bucket_id one bucket further. Returns false without
+  // changing anything if a probe distance would overflow.
+  bool shift_robin_hood(const size_t bucket_id);
+
+  void grow_robin_hood();
+
+  size_t get_wrapped_bucket_id(size_t bucket_id) const {
+    while (bucket_id >= n_buckets) bucket_id -= n_buckets;
+    return bucket_id;
+  }
+
+  size_t get_prev_bucket_id(const size_t bucket_id) const {
+    return bucket_id == 0 ? n_buckets - 1 : bucket_id - 1;
+  }
+
+  size_t get_distance(const size_t bucket_id, const size_t hash_value) const {
+    const size_t home_bucket_id = get_bucket_id(hash_value);
+    return bucket_id >= home_bucket_id ? bucket_id - home_bucket_id
+                                       : bucket_id + n_buckets - home_bucket_id;
+  }
 };
 
-template <class K, class V, class H>
-BareHashContainer<K, V, H>::BareHashContainer() {
+template <class K, class V, class H, class P, class A>
+BareHashContainer<K, V, H, P, A>::BareHashContainer() {
   n_keys = 0;
-  n_buckets = N_INITIAL_BUCKETS;
-  buckets.resize(N_INITIAL_BUCKETS);
+  n_buckets = P::get_n_initial_buckets();
+  buckets.resize(n_buckets);
+  reset_ctrl();
   max_load_factor = DEFAULT_MAX_LOAD_FACTOR;
   unbalanced_warned = false;
+  seed = 0;
+  n_reseeds = 0;
+  n_migrated_buckets = 0;
+  keep_replaced_tables = false;
 }
 
-template <class K, class V, class H>
-void BareHashContainer<K, V, H>::reserve(const size_t n_keys_min) {
+template <class K, class V, class H, class P, class A>
+void BareHashContainer<K, V, H, P, A>::reserve(const size_t n_keys_min) {
   reserve_n_buckets(n_keys_min / max_load_factor);
 }
 
-template <class K, class V, class H>
-void BareHashContainer<K, V, H>::reserve_n_buckets(const size_t n_buckets_min) {
+template <class K, class V, class H, class P, class A>
+void BareHashContainer<K, V, H, P, A>::reserve_n_buckets(const size_t n_buckets_min) {
   if (n_buckets_min <= n_buckets) return;
-  const size_t n_rehash_buckets = get_n_rehash_buckets(n_buckets_min);
+  const size_t n_rehash_buckets = P::get_n_buckets(n_buckets_min);
   rehash(n_rehash_buckets);
 }
 
-template <class K, class V, class H>
-size_t BareHashContainer<K, V, H>::get_n_rehash_buckets(const size_t n_buckets_min) {
-  constexpr size_t PRIMES[] = {
-      11, 17, 29, 47, 79, 127, 211, 337, 547, 887, 1433, 2311, 3739, 6053, 9791, 15859};
-  constexpr size_t N_PRIMES = sizeof(PRIMES) / sizeof(size_t);
-  constexpr size_t LAST_PRIME = PRIMES[N_PRIMES - 1];
-  constexpr size_t BIG_PRIME = PRIMES[N_PRIMES - 5];
-  size_t remaining_factor = n_buckets_min + n_buckets_min / 4;
-  size_t n_rehash_buckets = 1;
-  while (remaining_factor > LAST_PRIME) {
-    remaining_factor /= BIG_PRIME;
-    n_rehash_buckets *= BIG_PRIME;
+template <class K, class V, class H, class P, class A>
+void BareHashContainer<K, V, H, P, A>::rehash(const size_t n_rehash_buckets) {
+  begin_rehash(n_rehash_buckets);
+  migrate_all();
+}
+
+template <class K, class V, class H, class P, class A>
+void BareHashContainer<K, V, H, P, A>::reseed() {
+  if (n_reseeds == MAX_N_RESEEDS) throw std::runtime_error("Hash table is severely unbalanced.");
+  n_reseeds++;
+  std::random_device device;
+  const size_t new_seed = (static_cast<size_t>(device()) << 32) ^ device();
+  begin_rehash(n_buckets);
+  seed = new_seed == 0 ? 1 : new_seed;
+  migrate_all();
+}
+
+template <class K, class V, class H, class P, class A>
+void BareHashContainer<K, V, H, P, A>::migrate_all() {
+  // Robin Hood tables keep their entries ordered by probe distance, which concurrent inserts break.
+  if (!P::ROBIN_HOOD && old_buckets.size() >= PARALLEL_REHASH_MIN_BUCKETS && !omp_in_parallel() &&
+      omp_get_max_threads() > 1) {
+    migrate_parallel();
+  } else {
+    migrate(old_buckets.size());
   }
+}
 
-  // Find a prime larger than or equal to the remaining factor with binary search.
-  size_t left = 0, right = N_PRIMES - 1;
-  while (left < right) {
-    size_t mid = (left + right) / 2;
-    if (PRIMES[mid] < remaining_factor) {
-      left = mid + 1;
-    } else {
-      right = mid;
+template <class K, class V, class H, class P, class A>
+void BareHashContainer<K, V, H, P, A>::grow() {
+  if (P::N_REHASH_STEP_BUCKETS == 0) {
+    reserve_n_buckets(n_buckets * 2);
+  } else {
+    begin_rehash(P::get_n_buckets(n_buckets * 2));
+  }
+}
+
+template <class K, class V, class H, class P, class A>
+void BareHashContainer<K, V, H, P, A>::begin_rehash(const size_t n_rehash_buckets) {
+  migrate(old_buckets.size());  // Finish the previous incremental rehash first.
+  if (n_rehash_buckets != n_buckets) n_reseeds = 0;
+  old_buckets.swap(buckets);
+  old_ctrl.swap(ctrl);
+  buckets.resize(n_rehash_buckets);
+  n_buckets = n_rehash_buckets;
+  reset_ctrl();
+  n_migrated_buckets = 0;
+}
+
+template <class K, class V, class H, class P, class A>
+void BareHashContainer<K, V, H, P, A>::migrate(size_t n_migrate_buckets) {
+  while (n_migrate_buckets > 0 && n_migrated_buckets < old_buckets.size()) {
+    const size_t old_bucket_id = n_migrated_buckets;
+    n_migrated_buckets++;
+    n_migrate_buckets--;
+    if (!ControlGroup::is_full(old_ctrl[old_bucket_id])) continue;
+    old_ctrl[old_bucket_id] = ControlGroup::DELETED;
+    // Take the entry out first since inserting it may grow the table and free the old buckets.
+    HashEntry<K, V, H> entry(std::move(old_buckets[old_bucket_id]));
+    insert(std::move(entry));
+  }
+  if (n_migrated_buckets == old_buckets.size()) release_old_buckets();
+}
+
+template <class K, class V, class H, class P, class A>
+void BareHashContainer<K, V, H, P, A>::migrate_parallel() {
+  const size_t n_old_buckets = old_buckets.size();
+#pragma omp parallel for schedule(static, 4096)
+  for (size_t i = n_migrated_buckets; i < n_old_buckets; i++) {
+    if (!ControlGroup::is_full(old_ctrl[i])) continue;
+    const size_t hash_value = old_buckets[i].get_hash_value(hasher);
+    const uint8_t tag = ControlGroup::get_tag(hash_value);
+    // The keys are distinct, so claiming the first empty control byte on the way is enough.
+    size_t bucket_id = get_bucket_id(hash_value);
+    uint8_t expected = ControlGroup::EMPTY;
+    while (!__atomic_compare_exchange_n(
+        &ctrl[bucket_id], &expected, tag, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+      expected = ControlGroup::EMPTY;
+      bucket_id = get_next_bucket_id(bucket_id);
     }
+    buckets[bucket_id] = std::move(old_buckets[i]);
   }
-  n_rehash_buckets *= PRIMES[left];
-  return n_rehash_buckets;
+  const size_t n_ctrl = ctrl.size();
+  for (size_t i = n_buckets; i < n_ctrl; i++) ctrl[i] = ctrl[i - n_buckets];
+  release_old_buckets();
 }
 
-template <class K, class V, class H>
-void BareHashContainer<K, V, H>::rehash(const size_t n_rehash_buckets) {
-  std::vector<HashEntry<K, V>> rehash_buckets(n_rehash_buckets);
-  for (size_t i = 0; i < n_buckets; i++) {
-    if (!buckets.at(i).filled) continue;
-    const size_t hash_value = buckets.at(i).hash_value;
-    size_t rehash_bucket_id = hash_value % n_rehash_buckets;
-    size_t n_probes = 0;
-    while (n_probes < n_rehash_buckets) {
-      if (!rehash_buckets.at(rehash_bucket_id).filled) {
-        rehash_buckets.at(rehash_bucket_id) = buckets.at(i);
-        break;
-      } else {
-        n_probes++;
-        rehash_bucket_id = (rehash_bucket_id + 1) % n_rehash_buckets;
+template <class K, class V, class H, class P, class A>
+void BareHashContainer<K, V, H, P, A>::release_old_buckets() {
+  if (keep_replaced_tables && !old_ctrl.empty()) {
+    replaced_buckets.push_back(Vector<HashEntry<K, V, H>>());
+    replaced_buckets.back().swap(old_buckets);
+    replaced_ctrl.push_back(Vector<uint8_t>());
+    replaced_ctrl.back().swap(old_ctrl);
+  }
+  Vector<HashEntry<K, V, H>>().swap(old_buckets);
+  Vector<uint8_t>().swap(old_ctrl);
+  n_migrated_buckets = 0;
+}
+
+template <class K, class V, class H, class P, class A>
+void BareHashContainer<K, V, H, P, A>::insert(HashEntry<K, V, H>&& entry) {
+  const size_t hash_value = entry.get_hash_value(hasher);
+  size_t n_probes;
+  size_t bucket_id = find_insert_bucket_id(hash_value, n_probes);
+  bucket_id = claim_bucket(bucket_id, n_probes, hash_value);
+  buckets[bucket_id] = std::move(entry);
+}
+
+template <class K, class V, class H, class P, class A>
+void BareHashContainer<K, V, H, P, A>::reset_ctrl() {
+  ctrl.assign(n_buckets + ControlGroup::SIZE - 1, static_cast<uint8_t>(ControlGroup::EMPTY));
+}
+
+template <class K, class V, class H, class P, class A>
+void BareHashContainer<K, V, H, P, A>::set_ctrl(const size_t bucket_id, const uint8_t ctrl_byte) {
+  const size_t n_ctrl = ctrl.size();
+  for (size_t i = bucket_id; i < n_ctrl; i += n_buckets) ctrl[i] = ctrl_byte;
+}
+
+template <class K, class V, class H, class P, class A>
+template <class KL>
+bool BareHashContainer<K, V, H, P, A>::probe(
+    const TableView& table,
+    const KL& key,
+    const size_t hash_value,
+    size_t& bucket_id,
+    size_t& n_probes) const {
+  if (P::ROBIN_HOOD) return probe_robin_hood(table, key, hash_value, bucket_id, n_probes);
+  const uint8_t tag = ControlGroup::get_tag(hash_value);
+  size_t group_id = table.get_bucket_id(hash_value);
+  n_probes = 0;
+  while (n_probes < table.n_buckets) {
+    const ControlGroup group(table.ctrl + group_id);
+    const uint32_t empty_mask = group.match_empty();
+    uint32_t match_mask = group.match(tag);
+    // Entries after the first empty bucket belong to other probe sequences.
+    if (empty_mask != 0) match_mask &= (empty_mask & -empty_mask) - 1;
+    while (match_mask != 0) {
+      const int offset = __builtin_ctz(match_mask);
+      const size_t match_bucket_id = table.get_wrapped_bucket_id(group_id + offset);
+      const auto& entry = table.buckets[match_bucket_id];
+      if (entry.has_key(key, hash_value)) {
+        bucket_id = match_bucket_id;
+        n_probes += offset;
+        return true;
       }
+      match_mask &= match_mask - 1;
     }
-    assert(n_probes < n_rehash_buckets);
+    if (empty_mask != 0) {
+      const int offset = __builtin_ctz(empty_mask);
+      bucket_id = table.get_wrapped_bucket_id(group_id + offset);
+      n_probes += offset;
+      return false;
+    }
+    n_probes += ControlGroup::SIZE;
+    group_id = table.get_wrapped_bucket_id(group_id + ControlGroup::SIZE);
   }
-  buckets = std::move(rehash_buckets);
-  n_buckets = n_rehash_buckets;
+  bucket_id = table.n_buckets;
+  return false;
+}
+
+template <class K, class V, class H, class P, class A>
+template <class KL>
+bool BareHashContainer<K, V, H, P, A>::probe_robin_hood(
+    const TableView& table,
+    const KL& key,
+    const size_t hash_value,
+    size_t& bucket_id,
+    size_t& n_probes) const {
+  size_t group_id = table.get_bucket_id(hash_value);
+  for (size_t first = 0; first <= ControlGroup::MAX_DISTANCE; first += ControlGroup::SIZE) {
+    const ControlGroup group(table.ctrl + group_id);
+    // Stop at the first bucket that is empty or whose entry is closer to its home than the probe.
+    const uint32_t stop_mask = group.match_below_sequence(first);
+    uint32_t match_mask = group.match_sequence(first);
+    if (stop_mask != 0) match_mask &= (stop_mask & -stop_mask) - 1;
+    while (match_mask != 0) {
+      const int offset = __builtin_ctz(match_mask);
+      const size_t match_bucket_id = table.get_wrapped_bucket_id(group_id + offset);
+      const auto& entry = table.buckets[match_bucket_id];
+      if (entry.has_key(key, hash_value)) {
+        bucket_id = match_bucket_id;
+        n_probes = first + offset;
+        return true;
+      }
+      match_mask &= match_mask - 1;
+    }
+    if (stop_mask != 0) {
+      const int offset = __builtin_ctz(stop_mask);
+      bucket_id = table.get_wrapped_bucket_id(group_id + offset);
+      n_probes = first + offset;
+      return false;
+    }
+    group_id = table.get_wrapped_bucket_id(group_id + ControlGroup::SIZE);
+  }
+  // Only reached by optimistic lookups that overlapped a writer.
+  bucket_id = table.n_buckets;
+  n_probes = table.n_buckets;
+  return false;
 }
 
-template <class K, class V, class H>
-void BareHashContainer<K, V, H>::check_balance(const size_t n_probes) {
+template <class K, class V, class H, class P, class A>
+template <class KL>
+bool BareHashContainer<K, V, H, P, A>::probe_old(
+    const KL& key, const size_t hash_value, size_t& old_bucket_id) const {
+  if (P::N_REHASH_STEP_BUCKETS == 0 || old_buckets.empty()) return false;
+  const size_t n_old_buckets = old_buckets.size();
+  const uint8_t tag = ControlGroup::get_tag(hash_value);
+  old_bucket_id = P::get_bucket_id(get_seeded_hash_value(hash_value), n_old_buckets);
+  for (size_t n_probes = 0; old_ctrl[old_bucket_id] != ControlGroup::EMPTY; n_probes++) {
+    const uint8_t ctrl_byte = old_ctrl[old_bucket_id];
+    if (P::ROBIN_HOOD && ctrl_byte < n_probes) return false;
+    if (ctrl_byte == (P::ROBIN_HOOD ? n_probes : tag)) {
+      const auto& entry = old_buckets[old_bucket_id];
+      if (entry.has_key(key, hash_value)) return true;
+    }
+    old_bucket_id = P::get_next_bucket_id(old_bucket_id, n_old_buckets);
+  }
+  return false;
+}
+
+template <class K, class V, class H, class P, class A>
+size_t BareHashContainer<K, V, H, P, A>::find_insert_bucket_id(
+    const size_t hash_value, size_t& n_probes) const {
+  size_t group_id = get_bucket_id(hash_value);
+  n_probes = 0;
+  while (true) {
+    const ControlGroup group(ctrl.data() + group_id);
+    const uint32_t stop_mask =
+        P::ROBIN_HOOD ? group.match_below_sequence(n_probes) : group.match_empty();
+    if (stop_mask != 0) {
+      const int offset = __builtin_ctz(stop_mask);
+      n_probes += offset;
+      return get_wrapped_bucket_id(group_id + offset);
+    }
+    n_probes += ControlGroup::SIZE;
+    group_id = get_wrapped_bucket_id(group_id + ControlGroup::SIZE);
+  }
+}
+
+template <class K, class V, class H, class P, class A>
+size_t BareHashContainer<K, V, H, P, A>::claim_bucket(
+    size_t bucket_id, size_t n_probes, const size_t hash_value) {
+  if (!P::ROBIN_HOOD) {
+    set_ctrl(bucket_id, ControlGroup::get_tag(hash_value));
+    return bucket_id;
+  }
+  while (n_probes > ControlGroup::MAX_DISTANCE ||
+         (ctrl[bucket_id] != ControlGroup::EMPTY && !shift_robin_hood(bucket_id))) {
+    grow_robin_hood();
+    bucket_id = find_insert_bucket_id(hash_value, n_probes);
+  }
+  set_ctrl(bucket_id, n_probes);
+  return bucket_id;
+}
+
+template <class K, class V, class H, class P, class A>
+bool BareHashContainer<K, V, H, P, A>::shift_robin_hood(const size_t bucket_id) {
+  size_t end_bucket_id = bucket_id;
+  while (ctrl[end_bucket_id] != ControlGroup::EMPTY) {
+    if (ctrl[end_bucket_id] == ControlGroup::MAX_DISTANCE) return false;
+    end_bucket_id = get_next_bucket_id(end_bucket_id);
+  }
+  while (end_bucket_id != bucket_id) {
+    const size_t prev_bucket_id = get_prev_bucket_id(end_bucket_id);
+    buckets[end_bucket_id] = std::move(buckets[prev_bucket_id]);
+    set_ctrl(end_bucket_id, ctrl[prev_bucket_id] + 1);
+    end_bucket_id = prev_bucket_id;
+  }
+  return true;
+}
+
+template <class K, class V, class H, class P, class A>
+void BareHashContainer<K, V, H, P, A>::grow_robin_hood() {
+  if (n_keys < n_buckets / 4) {
+    reseed();
+  } else {
+    rehash(P::get_n_buckets(n_buckets * 2));
+  }
+}
+
+template <class K, class V, class H, class P, class A>
+void BareHashContainer<K, V, H, P, A>::check_balance(const size_t n_probes) {
   assert(n_probes < n_buckets);
   if (n_probes > MAX_N_PROBES) {
-    if (n_keys < n_buckets / 4 && !unbalanced_warned) {
-      fprintf(stderr, "Warning: Hash table is unbalanced!\n");
-      unbalanced_warned = true;
+    if (n_keys >= n_buckets / 4) {
+      reserve_n_buckets(n_buckets * 2);
+      return;
     }
-    if (n_keys < n_buckets / 16) {
-      throw std::runtime_error("Hash table is severely unbalanced.");
+    if (!unbalanced_warned) {
+      fprintf(stderr, "Warning: Hash table is unbalanced! Rehashing with a new seed.\n");
+      unbalanced_warned = true;
     }
-    reserve_n_buckets(n_buckets * 2);
+    reseed();
   }
 }
 
-template <class K, class V, class H>
-void BareHashContainer<K, V, H>::unset(const K& key, const size_t hash_value) {
-  size_t bucket_id = hash_value % n_buckets;
-  size_t n_probes = 0;
-  while (n_probes < n_buckets) {
-    if (!buckets.at(bucket_id).filled) {
-      return;
-    } else if (buckets.at(bucket_id).hash_value == hash_value && buckets.at(bucket_id).key == key) {
-      buckets.at(bucket_id).filled = false;
+template <class K, class V, class H, class P, class A>
+template <class KL, class>
+void BareHashContainer<K, V, H, P, A>::unset(const KL& key, const size_t hash_value) {
+  rehash_step();
+  size_t bucket_id;
+  size_t n_probes;
+  if (!probe(key, hash_value, bucket_id, n_probes)) {
+    if (probe_old(key, hash_value, bucket_id)) {
+      old_ctrl[bucket_id] = ControlGroup::DELETED;
       n_keys--;
-      // Find a valid entry to fill the spot if exists.
-      size_t swap_bucket_id = (bucket_id + 1) % n_buckets;
-      while (buckets.at(swap_bucket_id).filled) {
-        const size_t swap_origin_id = buckets.at(swap_bucket_id).hash_value % n_buckets;
-        if ((swap_bucket_id < swap_origin_id && swap_origin_id <= bucket_id) ||
-            (swap_origin_id <= bucket_id && bucket_id < swap_bucket_id) ||
-            (bucket_id < swap_bucket_id && swap_bucket_id < swap_origin_id)) {
-          buckets.at(bucket_id) = buckets.at(swap_bucket_id);
-          buckets.at(swap_bucket_id).filled = false;
-          bucket_id = swap_bucket_id;
-        }
-        swap_bucket_id = (swap_bucket_id + 1) % n_buckets;
-      }
-      return;
-    } else {
-      n_probes++;
-      bucket_id = (bucket_id + 1) % n_buckets;
     }
+    return;
+  }
+  n_keys--;
+  if (P::ROBIN_HOOD) {
+    // Shift the following entries back until one is already at its home bucket.
+    size_t next_bucket_id = get_next_bucket_id(bucket_id);
+    while (ctrl[next_bucket_id] != ControlGroup::EMPTY && ctrl[next_bucket_id] != 0) {
+      buckets.at(bucket_id) = std::move(buckets.at(next_bucket_id));
+      set_ctrl(bucket_id, ctrl[next_bucket_id] - 1);
+      bucket_id = next_bucket_id;
+      next_bucket_id = get_next_bucket_id(next_bucket_id);
+    }
+    set_ctrl(bucket_id, ControlGroup::EMPTY);
+    return;
+  }
+  set_ctrl(bucket_id, ControlGroup::EMPTY);
+  // Find a valid entry to fill the spot if exists.
+  size_t swap_bucket_id = get_next_bucket_id(bucket_id);
+  while (ctrl[swap_bucket_id] != ControlGroup::EMPTY) {
+    const size_t swap_origin_id = get_bucket_id(buckets.at(swap_bucket_id).get_hash_value(hasher));
+    if ((swap_bucket_id < swap_origin_id && swap_origin_id <= bucket_id) ||
+        (swap_origin_id <= bucket_id && bucket_id < swap_bucket_id) ||
+        (bucket_id < swap_bucket_id && swap_bucket_id < swap_origin_id)) {
+      buckets.at(bucket_id) = std::move(buckets.at(swap_bucket_id));
+      set_ctrl(bucket_id, ctrl[swap_bucket_id]);
+      set_ctrl(swap_bucket_id, ControlGroup::EMPTY);
+      bucket_id = swap_bucket_id;
+    }
+    swap_bucket_id = get_next_bucket_id(swap_bucket_id);
   }
 }
 
-template <class K, class V, class H>
-bool BareHashContainer<K, V, H>::has(const K& key, const size_t hash_value) const {
-  size_t bucket_id = hash_value % n_buckets;
-  size_t n_probes = 0;
-  while (n_probes < n_buckets) {
-    if (!buckets.at(bucket_id).filled) {
-      return false;
-    } else if (buckets.at(bucket_id).hash_value == hash_value && buckets.at(bucket_id).key == key) {
-      return true;
-    } else {
-      n_probes++;
-      bucket_id = (bucket_id + 1) % n_buckets;
+template <class K, class V, class H, class P, class A>
+template <class KL, class>
+bool BareHashContainer<K, V, H, P, A>::has(const KL& key, const size_t hash_value) const {
+  size_t bucket_id;
+  size_t n_probes;
+  return probe(key, hash_value, bucket_id, n_probes) || probe_old(key, hash_value, bucket_id);
+}
+
+template <class K, class V, class H, class P, class A>
+void BareHashContainer<K, V, H, P, A>::has_batch(
+    const K* keys, const size_t* hash_values, const size_t n_batch_keys, bool* results) const {
+  for (size_t i = 0; i < n_batch_keys && i < BATCH_PREFETCH_DISTANCE; i++) {
+    prefetch(hash_values[i]);
+  }
+  for (size_t i = 0; i < n_batch_keys; i++) {
+    if (i + BATCH_PREFETCH_DISTANCE < n_batch_keys) {
+      prefetch(hash_values[i + BATCH_PREFETCH_DISTANCE]);
     }
+    results[i] = has(keys[i], hash_values[i]);
   }
-  return false;
 }
 
-template <class K, class V, class H>
-void BareHashContainer<K, V, H>::clear() {
+template <class K, class V, class H, class P, class A>
+void BareHashContainer<K, V, H, P, A>::clear() {
+  release_old_buckets();
+  if (n_keys == 0) return;
+  reset_ctrl();
+  n_keys = 0;
+}
+
+template <class K, class V, class H, class P, class A>
+void BareHashContainer<K, V, H, P, A>::clear_and_shrink() {
+  n_buckets = P::get_n_initial_buckets();
+  buckets.resize(n_buckets);
+  reset_ctrl();
+  n_reseeds = 0;
+  clear();
+}
+
+template <class K, class V, class H, class P, class A>
+template <class F>
+void BareHashContainer<K, V, H, P, A>::for_each_entry(const F& handler) const {
   if (n_keys == 0) return;
   for (size_t i = 0; i < n_buckets; i++) {
-    buckets.at(i).filled = false;
+    if (ControlGroup::is_full(ctrl[i])) handler(buckets[i]);
+  }
+  const size_t n_old_buckets = old_buckets.size();
+  for (size_t i = 0; i < n_old_buckets; i++) {
+    if (ControlGroup::is_full(old_ctrl[i])) handler(old_buckets[i]);
+  }
+}
+
+template <class K, class V, class H, class P, class A>
+template <class F>
+void BareHashContainer<K, V, H, P, A>::group_buckets(
+    const F& get_group_id,
+    const size_t n_groups,
+    std::vector<size_t>& bucket_ids,
+    std::vector<size_t>& group_starts) const {
+  // Counting sort in two sweeps, so that only the ids are stored.
+  group_starts.assign(n_groups + 1, 0);
+  for_each_bucket_hash_value([&](const size_t, const size_t hash_value) {
+    group_starts[get_group_id(hash_value) + 1]++;
+  });
+  for (size_t i = 0; i < n_groups; i++) group_starts[i + 1] += group_starts[i];
+  bucket_ids.resize(n_keys);
+  std::vector<size_t> group_cursors(group_starts.begin(), group_starts.end() - 1);
+  for_each_bucket_hash_value([&](const size_t bucket_id, const size_t hash_value) {
+    bucket_ids[group_cursors[get_group_id(hash_value)]++] = bucket_id;
+  });
+}
+
+template <class K, class V, class H, class P, class A>
+template <class F>
+void BareHashContainer<K, V, H, P, A>::for_each_bucket_hash_value(const F& handler) const {
+  if (n_keys == 0) return;
+  for (size_t i = 0; i < n_buckets; i++) {
+    if (ControlGroup::is_full(ctrl[i])) handler(i, buckets[i].get_hash_value(hasher));
+  }
+  const size_t n_old_buckets = old_buckets.size();
+  for (size_t i = 0; i < n_old_buckets; i++) {
+    if (ControlGroup::is_full(old_ctrl[i])) {
+      handler(n_buckets + i, old_buckets[i].get_hash_value(hasher));
+    }
   }
-  n_keys = 0;
 }
 
-template <class K, class V, class H>
-void BareHashContainer<K, V, H>::clear_and_shrink() {
-  buckets.resize(N_INITIAL_BUCKETS);
-  n_buckets = N_INITIAL_BUCKETS;
+template <class K, class V, class H, class P, class A>
+template <class F>
+void BareHashContainer<K, V, H, P, A>::drain_entries(const F& handler) {
+  if (n_keys > 0) {
+    for (size_t i = 0; i < n_buckets; i++) {
+      if (ControlGroup::is_full(ctrl[i])) handler(buckets[i]);
+    }
+    const size_t n_old_buckets = old_buckets.size();
+    for (size_t i = 0; i < n_old_buckets; i++) {
+      if (ControlGroup::is_full(old_ctrl[i])) handler(old_buckets[i]);
+    }
+  }
   clear();
 }
 
-template <class K, class V, class H>
+template <class K, class V, class H, class P, class A>
+template <class F>
+size_t BareHashContainer<K, V, H, P, A>::erase_entries_if(const F& predicate) {
+  if (n_keys == 0) return 0;
+  size_t n_erased = 0;
+  const size_t n_old_buckets = old_buckets.size();
+  for (size_t i = n_migrated_buckets; i < n_old_buckets; i++) {
+    if (ControlGroup::is_full(old_ctrl[i]) && predicate(old_buckets[i])) {
+      old_ctrl[i] = ControlGroup::DELETED;
+      n_erased++;
+    }
+  }
+
+  // Start after an empty bucket so that no cluster wraps around the start of the sweep.
+  size_t start_bucket_id = 0;
+  while (ctrl[start_bucket_id] != ControlGroup::EMPTY) start_bucket_id++;
+  size_t bucket_id = start_bucket_id;
+  bool cluster_has_holes = false;
+  for (size_t i = 0; i < n_buckets; i++) {
+    bucket_id = get_next_bucket_id(bucket_id);
+    const uint8_t ctrl_byte = ctrl[bucket_id];
+    if (!ControlGroup::is_full(ctrl_byte)) {
+      cluster_has_holes = false;  // Buckets ahead of the sweep are only emptied by the sweep.
+      continue;
+    }
+    auto& entry = buckets[bucket_id];
+    if (predicate(entry)) {
+      set_ctrl(bucket_id, ControlGroup::EMPTY);
+      n_erased++;
+      cluster_has_holes = true;
+      continue;
+    }
+    if (!cluster_has_holes) continue;
+
+    // Move the entry to the first hole on its probe path, if any. Robin Hood control bytes hold
+    // the probe distance, so the home bucket is known without hashing.
+    size_t target_bucket_id =
+        P::ROBIN_HOOD ? get_wrapped_bucket_id(bucket_id + n_buckets - ctrl_byte)
+                      : get_bucket_id(entry.get_hash_value(hasher));
+    while (target_bucket_id != bucket_id && ControlGroup::is_full(ctrl[target_bucket_id])) {
+      target_bucket_id = get_next_bucket_id(target_bucket_id);
+    }
+    if (target_bucket_id == bucket_id) continue;
+    const size_t n_shifts = bucket_id > target_bucket_id ? bucket_id - target_bucket_id
+                                                         : bucket_id + n_buckets - target_bucket_id;
+    buckets[target_bucket_id] = std::move(entry);
+    set_ctrl(target_bucket_id, P::ROBIN_HOOD ? ctrl_byte - n_shifts : ctrl_byte);
+    set_ctrl(bucket_id, ControlGroup::EMPTY);
+  }
+  n_keys -= n_erased;
+  return n_erased;
+}
+
+template <class K, class V, class H, class P, class A>
 template <class B>
-void BareHashContainer<K, V, H>::serialize(hps::OutputBuffer<B>& buf) const {
+void BareHashContainer<K, V, H, P, A>::serialize(hps::OutputBuffer<B>& buf) const {
   hps::Serializer<size_t, B>::serialize(n_keys, buf);
   hps::Serializer<float, B>::serialize(max_load_factor, buf);
-  hps::Serializer<std::vector<HashEntry<K, V>>, B>::serialize(buckets, buf);
+  hps::Serializer<size_t, B>::serialize(seed, buf);
+  serialize_buckets(buckets, ctrl, buf);
+  if (P::N_REHASH_STEP_BUCKETS > 0) serialize_buckets(old_buckets, old_ctrl, buf);
 }
 
-template <class K, class V, class H>
+template <class K, class V, class H, class P, class A>
 template <class B>
-void BareHashContainer<K, V, H>::parse(hps::InputBuffer<B>& buf) {
+void BareHashContainer<K, V, H, P, A>::serialize_buckets(
+    const Vector<HashEntry<K, V, H>>& table_buckets,
+    const Vector<uint8_t>& table_ctrl,
+    hps::OutputBuffer<B>& buf) {
+  const size_t n_table_buckets = table_buckets.size();
+  hps::Serializer<size_t, B>::serialize(n_table_buckets, buf);
+  for (size_t i = 0; i < n_table_buckets; i++) {
+    const bool filled = ControlGroup::is_full(table_ctrl[i]);
+    hps::Serializer<bool, B>::serialize(filled, buf);
+    if (filled) hps::Serializer<HashEntry<K, V, H>, B>::serialize(table_buckets[i], buf);
+  }
+}
+
+template <class K, class V, class H, class P, class A>
+template <class B>
+void BareHashContainer<K, V, H, P, A>::parse(hps::InputBuffer<B>& buf) {
   hps::Serializer<size_t, B>::parse(n_keys, buf);
   hps::Serializer<float, B>::parse(max_load_factor, buf);
-  hps::Serializer<std::vector<HashEntry<K, V>>, B>::parse(buckets, buf);
-  n_buckets = buckets.size();
+  hps::Serializer<size_t, B>::parse(seed, buf);
+  hps::Serializer<size_t, B>::parse(n_buckets, buf);
+  buckets.assign(n_buckets, HashEntry<K, V, H>());
+  reset_ctrl();
+  bool filled;
+  for (size_t i = 0; i < n_buckets; i++) {
+    hps::Serializer<bool, B>::parse(filled, buf);
+    if (!filled) continue;
+    hps::Serializer<HashEntry<K, V, H>, B>::parse(buckets[i], buf);
+    const size_t hash_value = buckets[i].get_hash_value(hasher);
+    set_ctrl(i, P::ROBIN_HOOD ? get_distance(i, hash_value) : ControlGroup::get_tag(hash_value));
+  }
+  release_old_buckets();
+  if (P::N_REHASH_STEP_BUCKETS > 0) {
+    // Finish the incremental rehash in progress when serialized.
+    size_t n_parsed_old_buckets;
+    hps::Serializer<size_t, B>::parse(n_parsed_old_buckets, buf);
+    for (size_t i = 0; i < n_parsed_old_buckets; i++) {
+      hps::Serializer<bool, B>::parse(filled, buf);
+      if (!filled) continue;
+      HashEntry<K, V, H> entry;
+      hps::Serializer<HashEntry<K, V, H>, B>::parse(entry, buf);
+      insert(std::move(entry));
+    }
+  }
 }
 }  // namespace hpmr
@@ -10,96 +10,205 @@
 namespace hpmr {
 
 // A linear probing hash map that requires providing hash values when use.
-template <class K, class V, class H = std::hash<K>>
-class BareMap : public BareHashContainer<K, V, H> {
+template <
+    class K,
+    class V,
+    class H = Hash<K>,
+    class P = PrimeBucketPolicy,
+    class A = std::allocator<char>>
+class BareMap : public BareHashContainer<K, V, H, P, A> {
  public:
-  void set(
-      const K& key,
+  // The reducer R is called as reducer(V& value, const V& new_value) when the key exists. Any
+  // function, functor or lambda works, and functor types such as Reducer<V>::Sum get inlined.
+  template <class R = typename Reducer<V>::Overwrite>
+  void set(const K& key, const size_t hash_value, const V& value, const R& reducer = R()) {
+    set_entry(key, hash_value, value, reducer);
+  }
+
+  // Moves the key and the value in if the key is new.
+  template <class R = typename Reducer<V>::Overwrite>
+  void set(K&& key, const size_t hash_value, V&& value, const R& reducer = R()) {
+    set_entry(std::move(key), hash_value, std::move(value), reducer);
+  }
+
+  V get(const K& key, const size_t hash_value, const V& default_value = V()) const {
+    return get<K>(key, hash_value, default_value);
+  }
+
+  // Takes keys of other types when the hasher is transparent.
+  template <class KL, class = EnableIfLookupKey<K, KL, H>>
+  V get(const KL& key, const size_t hash_value, const V& default_value = V()) const;
+
+  // Like has_optimistic, but sets value to the value of the key or default_value.
+  template <class KL, class F>
+  bool get_optimistic(
+      const KL& key,
       const size_t hash_value,
-      const V& value,
-      const std::function<void(V&, const V&)>& reducer = hpmr::Reducer<V>::overwrite);
+      const V& default_value,
+      V& value,
+      const F& validate) const {
+    const auto table = this->get_table_view();
+    if (!validate() || table.has_old_buckets) return false;
+    size_t bucket_id;
+    size_t n_probes;
+    value = probe(table, key, hash_value, bucket_id, n_probes) ? table.buckets[bucket_id].value
+                                                                : default_value;
+    return true;
+  }
 
-  V get(const K& key, const size_t hash_value, const V& default_value = V()) const;
+  // Looks up n_batch_keys keys and writes their values to values, prefetching a few keys ahead.
+  void get_batch(
+      const K* keys,
+      const size_t* hash_values,
+      const size_t n_batch_keys,
+      V* values,
+      const V& default_value = V()) const;
 
   void for_each(const std::function<void(const K& key, const size_t hash_value, const V& value)>&
                     handler) const;
 
-  using BareHashContainer<K, V, H>::max_load_factor;
+  // Moves each entry out to handler(K&& key, size_t hash_value, V&& value) and clears the map.
+  template <class F>
+  void drain(const F& handler);
 
-  using BareHashContainer<K, V, H>::reserve_n_buckets;
+  // Moves the entry of a bucket id from group_buckets out to handler(K&& key, size_t hash_value,
+  // V&& value). The map must be cleared once all the buckets are taken.
+  template <class F>
+  void take_bucket(const size_t bucket_id, const F& handler) {
+    auto& entry = get_bucket_entry(bucket_id);
+    const size_t hash_value = entry.get_hash_value(hasher);
+    handler(std::move(entry.key), hash_value, std::move(entry.value));
+  }
+
+  // Removes the entries for which predicate(const K& key, const V& value) is true in a single sweep
+  // and returns the number removed.
+  template <class F>
+  size_t erase_if(const F& predicate) {
+    return erase_entries_if(
+        [&](const HashEntry<K, V, H>& entry) { return predicate(entry.key, entry.value); });
+  }
+
+  using BareHashContainer<K, V, H, P, A>::max_load_factor;
+
+  using BareHashContainer<K, V, H, P, A>::reserve_n_buckets;
+
+  using BareHashContainer<K, V, H, P, A>::BATCH_PREFETCH_DISTANCE;
+
+  using BareHashContainer<K, V, H, P, A>::prefetch;
 
  protected:
-  using BareHashContainer<K, V, H>::n_keys;
+  using BareHashContainer<K, V, H, P, A>::n_keys;
+
+  using BareHashContainer<K, V, H, P, A>::n_buckets;
+
+  using BareHashContainer<K, V, H, P, A>::hasher;
+
+  using BareHashContainer<K, V, H, P, A>::buckets;
+
+  using BareHashContainer<K, V, H, P, A>::old_buckets;
 
-  using BareHashContainer<K, V, H>::n_buckets;
+  using BareHashContainer<K, V, H, P, A>::check_balance;
 
-  using BareHashContainer<K, V, H>::buckets;
+  using BareHashContainer<K, V, H, P, A>::probe;
 
-  using BareHashContainer<K, V, H>::check_balance;
+  using BareHashContainer<K, V, H, P, A>::claim_bucket;
+
+  using BareHashContainer<K, V, H, P, A>::probe_old;
+
+  using BareHashContainer<K, V, H, P, A>::grow;
+
+  using BareHashContainer<K, V, H, P, A>::rehash_step;
+
+  using BareHashContainer<K, V, H, P, A>::for_each_entry;
+
+  using BareHashContainer<K, V, H, P, A>::drain_entries;
+
+  using BareHashContainer<K, V, H, P, A>::get_bucket_entry;
+
+  using BareHashContainer<K, V, H, P, A>::erase_entries_if;
+
+ private:
+  template <class KF, class VF, class R>
+  void set_entry(KF&& key, const size_t hash_value, VF&& value, const R& reducer);
 };
 
-template <class K, class V, class H>
-void BareMap<K, V, H>::set(
-    const K& key,
-    const size_t hash_value,
-    const V& value,
-    const std::function<void(V&, const V&)>& reducer) {
-  size_t bucket_id = hash_value % n_buckets;
-  size_t n_probes = 0;
-  while (n_probes < n_buckets) {
-    if (!buckets.at(bucket_id).filled) {
-      buckets.at(bucket_id).fill(key, hash_value, value);
-      n_keys++;
-      if (n_buckets * max_load_factor <= n_keys) reserve_n_buckets(n_buckets * 2);
-      break;
-    } else if (buckets.at(bucket_id).hash_value == hash_value && buckets.at(bucket_id).key == key) {
-      reducer(buckets.at(bucket_id).value, value);
-      break;
-    } else {
-      n_probes++;
-      bucket_id = (bucket_id + 1) % n_buckets;
-    }
+template <class K, class V, class H, class P, class A>
+template <class KF, class VF, class R>
+void BareMap<K, V, H, P, A>::set_entry(
+    KF&& key, const size_t hash_value, VF&& value, const R& reducer) {
+  assert((StoreHashValue<K, H>::value || hash_value == hasher(key)));
+  rehash_step();
+  size_t bucket_id;
+  size_t n_probes;
+  size_t old_bucket_id;
+  if (probe(key, hash_value, bucket_id, n_probes)) {
+    reducer(buckets.at(bucket_id).value, value);
+  } else if (probe_old(key, hash_value, old_bucket_id)) {
+    reducer(old_buckets.at(old_bucket_id).value, value);
+  } else {
+    bucket_id = claim_bucket(bucket_id, n_probes, hash_value);
+    buckets.at(bucket_id).fill(std::forward<KF>(key), hash_value, std::forward<VF>(value));
+    n_keys++;
+    if (n_buckets * max_load_factor <= n_keys) grow();
   }
   check_balance(n_probes);
 }
 
-template <class K, class V, class H>
-V BareMap<K, V, H>::get(const K& key, const size_t hash_value, const V& default_value) const {
-  size_t bucket_id = hash_value % n_buckets;
-  size_t n_probes = 0;
-  while (n_probes < n_buckets) {
-    if (!buckets.at(bucket_id).filled) {
-      return default_value;
-    } else if (buckets.at(bucket_id).hash_value == hash_value && buckets.at(bucket_id).key == key) {
-      return buckets.at(bucket_id).value;
-    } else {
-      n_probes++;
-      bucket_id = (bucket_id + 1) % n_buckets;
+template <class K, class V, class H, class P, class A>
+template <class KL, class>
+V BareMap<K, V, H, P, A>::get(
+    const KL& key, const size_t hash_value, const V& default_value) const {
+  size_t bucket_id;
+  size_t n_probes;
+  if (probe(key, hash_value, bucket_id, n_probes)) return buckets.at(bucket_id).value;
+  if (probe_old(key, hash_value, bucket_id)) return old_buckets.at(bucket_id).value;
+  return default_value;
+}
+
+template <class K, class V, class H, class P, class A>
+void BareMap<K, V, H, P, A>::get_batch(
+    const K* keys,
+    const size_t* hash_values,
+    const size_t n_batch_keys,
+    V* values,
+    const V& default_value) const {
+  for (size_t i = 0; i < n_batch_keys && i < BATCH_PREFETCH_DISTANCE; i++) {
+    prefetch(hash_values[i]);
+  }
+  for (size_t i = 0; i < n_batch_keys; i++) {
+    if (i + BATCH_PREFETCH_DISTANCE < n_batch_keys) {
+      prefetch(hash_values[i + BATCH_PREFETCH_DISTANCE]);
     }
+    values[i] = get(keys[i], hash_values[i], default_value);
   }
-  return default_value;
 }
 
-template <class K, class V, class H>
-void BareMap<K, V, H>::for_each(
+template <class K, class V, class H, class P, class A>
+void BareMap<K, V, H, P, A>::for_each(
     const std::function<void(const K& key, const size_t hash_value, const V& value)>& handler)
     const {
-  if (n_keys == 0) return;
-  for (size_t i = 0; i < n_buckets; i++) {
-    if (buckets.at(i).filled) {
-      handler(buckets.at(i).key, buckets.at(i).hash_value, buckets.at(i).value);
-    }
-  }
+  for_each_entry([&](const HashEntry<K, V, H>& entry) {
+    handler(entry.key, entry.get_hash_value(hasher), entry.value);
+  });
+}
+
+template <class K, class V, class H, class P, class A>
+template <class F>
+void BareMap<K, V, H, P, A>::drain(const F& handler) {
+  drain_entries([&](HashEntry<K, V, H>& entry) {
+    const size_t hash_value = entry.get_hash_value(hasher);
+    handler(std::move(entry.key), hash_value, std::move(entry.value));
+  });
 }
 }  // namespace hpmr
 
 namespace hps {
-template <class K, class V, class H, class B>
-class Serializer<hpmr::BareMap<K, V, H>, B> {
+template <class K, class V, class H, class P, class A, class B>
+class Serializer<hpmr::BareMap<K, V, H, P, A>, B> {
  public:
-  static void serialize(const hpmr::BareMap<K, V, H>& map, OutputBuffer<B>& buf) {
+  static void serialize(const hpmr::BareMap<K, V, H, P, A>& map, OutputBuffer<B>& buf) {
     map.serialize(buf);
   }
-  static void parse(hpmr::BareMap<K, V, H>& map, InputBuffer<B>& buf) { map.parse(buf); }
+  static void parse(hpmr::BareMap<K, V, H, P, A>& map, InputBuffer<B>& buf) { map.parse(buf); }
 };
 }  // namespace hps
@@ -1,7 +1,12 @@
 #include "bare_map.h"
 
 #include <gtest/gtest.h>
+#include <algorithm>
+#include <memory>
 #include <unordered_map>
+#include <vector>
+#include "huge_page_allocator.h"
+#include "pool_allocator.h"
 #include "reducer.h"
 
 TEST(BareMapTest, Initialization) {
@@ -166,3 +171,356 @@ TEST(BareMapTest, ToAndFromString) {
   EXPECT_EQ(m2.get("aa", hasher("aa")), 1);
   EXPECT_EQ(m2.get("bbb", hasher("bbb")), 2);
 }
+
+TEST(BareMapTest, PowerOfTwoBucketPolicy) {
+  hpmr::BareMap<long long, int, std::hash<long long>, hpmr::PowerOfTwoBucketPolicy> m;
+  m.reserve(100);
+  const size_t n_buckets = m.get_n_buckets();
+  EXPECT_GE(n_buckets, 100 / m.max_load_factor);
+  EXPECT_EQ(n_buckets & (n_buckets - 1), 0);
+  constexpr long long N_KEYS = 1000000;
+  std::hash<long long> hasher;
+  for (long long i = 0; i < N_KEYS; i++) m.set(i << 16, hasher(i << 16), i);
+  EXPECT_EQ(m.get_n_keys(), N_KEYS);
+  for (long long i = 0; i < N_KEYS; i += 10) EXPECT_EQ(m.get(i << 16, hasher(i << 16)), i);
+  for (long long i = 0; i < N_KEYS; i += 2) m.unset(i << 16, hasher(i << 16));
+  EXPECT_EQ(m.get_n_keys(), N_KEYS / 2);
+  for (long long i = 0; i < N_KEYS; i++) {
+    EXPECT_EQ(m.has(i << 16, hasher(i << 16)), i % 2 == 1);
+  }
+}
+
+TEST(BareMapTest, RandomSetAndUnset) {
+  hpmr::BareMap<int, int> m;
+  std::unordered_map<int, int> expected;
+  std::hash<int> hasher;
+  unsigned state = 1;
+  for (int i = 0; i < 200000; i++) {
+    state = state * 1103515245 + 12345;
+    const int key = (state >> 8) % 5000;
+    if (i % 3 == 0) {
+      m.unset(key, hasher(key));
+      expected.erase(key);
+    } else {
+      m.set(key, hasher(key), i);
+      expected[key] = i;
+    }
+  }
+  EXPECT_EQ(m.get_n_keys(), expected.size());
+  for (int key = 0; key < 5000; key++) {
+    const auto it = expected.find(key);
+    if (it == expected.end()) {
+      EXPECT_FALSE(m.has(key, hasher(key)));
+    } else {
+      EXPECT_EQ(m.get(key, hasher(key)), it->second);
+    }
+  }
+}
+
+TEST(BareMapTest, RobinHoodBucketPolicy) {
+  hpmr::BareMap<int, int, std::hash<int>, hpmr::RobinHoodBucketPolicy<>> m;
+  m.max_load_factor = 0.9;
+  std::unordered_map<int, int> expected;
+  std::hash<int> hasher;
+  unsigned state = 1;
+  for (int i = 0; i < 500000; i++) {
+    state = state * 1103515245 + 12345;
+    const int key = (state >> 8) % 50000;
+    if (i % 3 == 0) {
+      m.unset(key, hasher(key));
+      expected.erase(key);
+    } else {
+      m.set(key, hasher(key), i);
+      expected[key] = i;
+    }
+  }
+  EXPECT_EQ(m.get_n_keys(), expected.size());
+  for (int key = 0; key < 50000; key++) {
+    const auto it = expected.find(key);
+    if (it == expected.end()) {
+      EXPECT_FALSE(m.has(key, hasher(key)));
+    } else {
+      EXPECT_EQ(m.get(key, hasher(key)), it->second);
+    }
+  }
+}
+
+TEST(BareMapTest, IncrementalRehashBucketPolicy) {
+  hpmr::BareMap<int, int, std::hash<int>, hpmr::IncrementalRehashBucketPolicy<>> m;
+  std::unordered_map<int, int> expected;
+  std::hash<int> hasher;
+  unsigned state = 1;
+  for (int i = 0; i < 300000; i++) {
+    state = state * 1103515245 + 12345;
+    const int key = (state >> 8) % 50000;
+    if (i % 3 == 0) {
+      m.unset(key, hasher(key));
+      expected.erase(key);
+    } else {
+      m.set(key, hasher(key), 1, hpmr::Reducer<int>::sum);
+      expected[key]++;
+    }
+    if (i % 1000 == 0) {
+      const auto it = expected.find(key);
+      EXPECT_EQ(m.get(key, hasher(key)), it == expected.end() ? 0 : it->second);
+    }
+  }
+  EXPECT_EQ(m.get_n_keys(), expected.size());
+  size_t n_keys = 0;
+  m.for_each([&](const int key, const size_t, const int value) {
+    EXPECT_EQ(value, expected[key]);
+    n_keys++;
+  });
+  EXPECT_EQ(n_keys, expected.size());
+  const std::string serialized = hps::serialize_to_string(m);
+  hpmr::BareMap<int, int, std::hash<int>, hpmr::IncrementalRehashBucketPolicy<>> m2;
+  hps::parse_from_string(m2, serialized);
+  EXPECT_EQ(m2.get_n_keys(), expected.size());
+  for (int key = 0; key < 50000; key++) {
+    const auto it = expected.find(key);
+    if (it == expected.end()) {
+      EXPECT_FALSE(m2.has(key, hasher(key)));
+    } else {
+      EXPECT_EQ(m2.get(key, hasher(key)), it->second);
+    }
+  }
+}
+
+TEST(BareMapTest, GroupAndTakeBuckets) {
+  // Grouping covers the old buckets of an incremental rehash in progress.
+  typedef hpmr::IncrementalRehashBucketPolicy<hpmr::PowerOfTwoBucketPolicy> IncrementalPolicy;
+  hpmr::BareMap<int, int, hpmr::Hash<int>, IncrementalPolicy> m;
+  hpmr::Hash<int> hasher;
+  m.reserve(1000);
+  const size_t n_initial_buckets = m.get_n_buckets();
+  int n_keys = 0;
+  while (m.get_n_buckets() == n_initial_buckets) {
+    m.set(n_keys, hasher(n_keys), n_keys);
+    n_keys++;
+  }
+  constexpr size_t N_GROUPS = 3;
+  std::vector<size_t> bucket_ids;
+  std::vector<size_t> group_starts;
+  m.group_buckets(
+      [](const size_t hash_value) { return hash_value % N_GROUPS; },
+      N_GROUPS,
+      bucket_ids,
+      group_starts);
+  EXPECT_EQ(group_starts.size(), N_GROUPS + 1);
+  EXPECT_EQ(group_starts[N_GROUPS], static_cast<size_t>(n_keys));
+  EXPECT_GE(*std::max_element(bucket_ids.begin(), bucket_ids.end()), m.get_n_buckets());
+  std::unordered_map<int, int> taken;
+  for (size_t group_id = 0; group_id < N_GROUPS; group_id++) {
+    for (size_t i = group_starts[group_id]; i < group_starts[group_id + 1]; i++) {
+      m.take_bucket(bucket_ids[i], [&](int&& key, const size_t hash_value, int&& value) {
+        EXPECT_EQ(hash_value % N_GROUPS, group_id);
+        taken[key] = value;
+      });
+    }
+  }
+  m.clear();
+  EXPECT_EQ(m.get_n_keys(), 0);
+  EXPECT_EQ(taken.size(), static_cast<size_t>(n_keys));
+  for (int i = 0; i < n_keys; i++) EXPECT_EQ(taken[i], i);
+}
+
+TEST(BareMapTest, PackedEntries) {
+  typedef hpmr::ComputedHash<hpmr::Hash<long long>> LongLongHash;
+  EXPECT_EQ((sizeof(hpmr::HashEntry<long long, double, LongLongHash>)), 16);
+  EXPECT_EQ((sizeof(hpmr::HashEntry<int, int, hpmr::ComputedHash<hpmr::Hash<int>>>)), 8);
+  EXPECT_EQ((sizeof(hpmr::HashEntry<int, int, hpmr::Hash<int>>)), 24);
+}
+
+TEST(BareMapTest, ArbitraryHashValues) {
+  // Hash values that do not come from the hasher find their keys across rehashes and unsets.
+  hpmr::BareMap<int, int> m;
+  constexpr int N_KEYS = 1000;
+  const auto& hash = [](const int key) { return static_cast<size_t>(key) * 7 + 3; };
+  for (int i = 0; i < N_KEYS; i++) m.set(i, hash(i), i);
+  for (int i = 0; i < N_KEYS; i += 2) m.unset(i, hash(i));
+  m.reserve(N_KEYS * 10);
+  for (int i = 0; i < N_KEYS; i++) {
+    if (i % 2 == 0) {
+      EXPECT_FALSE(m.has(i, hash(i)));
+    } else {
+      EXPECT_EQ(m.get(i, hash(i), -1), i);
+    }
+  }
+}
+
+TEST(BareMapTest, GetAndHasBatch) {
+  hpmr::BareMap<int, int> m;
+  constexpr int N_KEYS = 1000;
+  std::hash<int> hasher;
+  for (int i = 0; i < N_KEYS; i += 2) m.set(i, hasher(i), i * 3);
+  std::vector<int> keys(N_KEYS);
+  std::vector<size_t> hash_values(N_KEYS);
+  for (int i = 0; i < N_KEYS; i++) {
+    keys[i] = i;
+    hash_values[i] = hasher(i);
+  }
+  std::vector<int> values(N_KEYS);
+  m.get_batch(keys.data(), hash_values.data(), N_KEYS, values.data(), -1);
+  std::unique_ptr<bool[]> results(new bool[N_KEYS]);
+  m.has_batch(keys.data(), hash_values.data(), N_KEYS, results.get());
+  for (int i = 0; i < N_KEYS; i++) {
+    EXPECT_EQ(values[i], i % 2 == 0 ? i * 3 : -1);
+    EXPECT_EQ(results[i], i % 2 == 0);
+  }
+}
+
+TEST(BareMapTest, HugePageAllocator) {
+  hpmr::BareMap<int, int, std::hash<int>, hpmr::PrimeBucketPolicy, hpmr::HugePageAllocator<char>> m;
+  constexpr int N_KEYS = 1000000;
+  std::hash<int> hasher;
+  for (int i = 0; i < N_KEYS; i++) m.set(i, hasher(i), i);
+  EXPECT_EQ(m.get_n_keys(), N_KEYS);
+  for (int i = 0; i < N_KEYS; i++) EXPECT_EQ(m.get(i, hasher(i)), i);
+  auto m2 = m;
+  m.clear_and_shrink();
+  EXPECT_EQ(m2.get(N_KEYS - 1, hasher(N_KEYS - 1)), N_KEYS - 1);
+}
+
+TEST(BareMapTest, PoolAllocator) {
+  hpmr::BareMap<int, int, std::hash<int>, hpmr::PrimeBucketPolicy, hpmr::PoolAllocator<char>> m;
+  std::hash<int> hasher;
+  for (int round = 0; round < 3; round++) {
+    for (int i = 0; i < 10000; i++) m.set(i, hasher(i), i + round);
+    for (int i = 0; i < 10000; i++) EXPECT_EQ(m.get(i, hasher(i)), i + round);
+    m.clear_and_shrink();
+    EXPECT_EQ(m.get_n_keys(), 0);
+  }
+}
+
+TEST(BareMapTest, PoolHoldsBoundedMemory) {
+  hpmr::MemoryPool pool;
+  const size_t max_n_pooled_bytes = hpmr::MemoryPool::MAX_N_POOLED_BYTES;
+  const size_t block_size = 1 << 24;
+  std::vector<void*> blocks;
+  for (size_t i = 0; i < max_n_pooled_bytes / block_size * 2; i++) {
+    blocks.push_back(pool.allocate(block_size));
+  }
+  for (void* block : blocks) pool.deallocate(block, block_size);
+  EXPECT_EQ(pool.get_n_pooled_bytes(), max_n_pooled_bytes);
+  void* block = pool.allocate(block_size);
+  EXPECT_EQ(pool.get_n_pooled_bytes(), max_n_pooled_bytes - block_size);
+  pool.deallocate(block, block_size);
+}
+
+TEST(BareMapTest, LargeParallelRehash) {
+  hpmr::BareMap<std::string, int> m;
+  constexpr int N_KEYS = 500000;
+  std::hash<std::string> hasher;
+  for (int i = 0; i < N_KEYS; i++) {
+    const auto& key = std::to_string(i);
+    m.set(key, hasher(key), i);
+  }
+  m.reserve(N_KEYS * 4);
+  EXPECT_EQ(m.get_n_keys(), N_KEYS);
+  for (int i = 0; i < N_KEYS; i++) {
+    const auto& key = std::to_string(i);
+    EXPECT_EQ(m.get(key, hasher(key)), i);
+  }
+  const auto& key = std::to_string(N_KEYS);
+  EXPECT_FALSE(m.has(key, hasher(key)));
+}
+
+TEST(BareMapTest, MoveAwareSetAndRehash) {
+  hpmr::BareMap<std::string, std::vector<int>> m;
+  std::hash<std::string> hasher;
+  constexpr int N_KEYS = 1000;
+  std::vector<const int*> data(N_KEYS);
+  for (int i = 0; i < N_KEYS; i++) {
+    std::vector<int> value(8, i);
+    data[i] = value.data();
+    std::string key = std::to_string(i);
+    const size_t hash_value = hasher(key);
+    m.set(std::move(key), hash_value, std::move(value));
+  }
+  m.reserve(N_KEYS * 10);
+  for (int i = 0; i < N_KEYS; i += 2) {
+    const auto& key = std::to_string(i);
+    m.unset(key, hasher(key));
+  }
+  EXPECT_EQ(m.get_n_keys(), N_KEYS / 2);
+  m.for_each([&](const std::string& key, const size_t, const std::vector<int>& value) {
+    EXPECT_EQ(key, std::to_string(value[0]));
+    EXPECT_EQ(value.data(), data[value[0]]);
+  });
+}
+
+TEST(BareMapTest, FunctorReducers) {
+  hpmr::BareMap<int, long long> m;
+  std::hash<int> hasher;
+  for (int i = 0; i < 100; i++) {
+    m.set(i % 10, hasher(i % 10), i, hpmr::Reducer<long long>::Sum());
+  }
+  for (int i = 0; i < 10; i++) EXPECT_EQ(m.get(i, hasher(i)), 450 + i * 10);
+  const auto& keep_larger = [](long long& value, const long long& new_value) {
+    if (new_value > value) value = new_value;
+  };
+  m.set(0, hasher(0), 1000, keep_larger);
+  m.set(1, hasher(1), 0, keep_larger);
+  EXPECT_EQ(m.get(0, hasher(0)), 1000);
+  EXPECT_EQ(m.get(1, hasher(1)), 460);
+}
+
+TEST(BareMapTest, ReseedCollidingHashValues) {
+  hpmr::BareMap<std::string, int> m;
+  m.reserve(1000);
+  const size_t n_buckets = m.get_n_buckets();
+  constexpr int N_KEYS = 300;
+  // All the hash values map to the first bucket before the table is reseeded.
+  for (int i = 0; i < N_KEYS; i++) m.set(std::to_string(i), i * n_buckets, i);
+  EXPECT_EQ(m.get_n_buckets(), n_buckets);
+  for (int i = 0; i < N_KEYS; i++) EXPECT_EQ(m.get(std::to_string(i), i * n_buckets, -1), i);
+
+  const std::string serialized = hps::serialize_to_string(m);
+  hpmr::BareMap<std::string, int> m2;
+  hps::parse_from_string(m2, serialized);
+  for (int i = 0; i < N_KEYS; i++) EXPECT_EQ(m2.get(std::to_string(i), i * n_buckets, -1), i);
+}
+
+template <class M>
+void check_erase_if(M& m) {
+  std::unordered_map<int, int> expected;
+  hpmr::Hash<int> hasher;
+  unsigned state = 1;
+  for (int i = 0; i < 100000; i++) {
+    state = state * 1103515245 + 12345;
+    const int key = (state >> 8) % 50000;
+    m.set(key, hasher(key), i);
+    expected[key] = i;
+  }
+  const auto& predicate = [](const int key, const int value) { return (key + value) % 3 == 0; };
+  size_t n_expected_erased = 0;
+  for (auto it = expected.begin(); it != expected.end();) {
+    if (predicate(it->first, it->second)) {
+      it = expected.erase(it);
+      n_expected_erased++;
+    } else {
+      it++;
+    }
+  }
+  EXPECT_EQ(m.erase_if(predicate), n_expected_erased);
+  EXPECT_EQ(m.get_n_keys(), expected.size());
+  for (int key = 0; key < 50000; key++) {
+    const auto it = expected.find(key);
+    if (it == expected.end()) {
+      EXPECT_FALSE(m.has(key, hasher(key)));
+    } else {
+      EXPECT_EQ(m.get(key, hasher(key)), it->second);
+    }
+  }
+}
+
+TEST(BareMapTest, EraseIf) {
+  hpmr::BareMap<int, int> m;
+  m.max_load_factor = 0.9;
+  check_erase_if(m);
+  hpmr::BareMap<int, int, hpmr::Hash<int>, hpmr::RobinHoodBucketPolicy<>> robin_hood_m;
+  robin_hood_m.max_load_factor = 0.9;
+  check_erase_if(robin_hood_m);
+  hpmr::BareMap<int, int, hpmr::Hash<int>, hpmr::IncrementalRehashBucketPolicy<>> incremental_m;
+  check_erase_if(incremental_m);
+}
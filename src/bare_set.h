@@ -10,66 +10,123 @@
 namespace hpmr {
 
 // A linear probing hash map that requires providing hash values when use.
-template <class K, class H = std::hash<K>>
-class BareSet : public BareHashContainer<K, void, H> {
+template <
+    class K,
+    class H = Hash<K>,
+    class P = PrimeBucketPolicy,
+    class A = std::allocator<char>>
+class BareSet : public BareHashContainer<K, void, H, P, A> {
  public:
-  void set(const K& key, const size_t hash_value);
+  void set(const K& key, const size_t hash_value) { set_entry(key, hash_value); }
+
+  // Moves the key in if it is new.
+  void set(K&& key, const size_t hash_value) { set_entry(std::move(key), hash_value); }
 
   void for_each(const std::function<void(const K& key, const size_t hash_value)>& handler) const;
 
-  using BareHashContainer<K, void, H>::max_load_factor;
+  // Moves each key out to handler(K&& key, size_t hash_value) and clears the set.
+  template <class F>
+  void drain(const F& handler);
+
+  // Moves the key of a bucket id from group_buckets out to handler(K&& key, size_t hash_value). The
+  // set must be cleared once all the buckets are taken.
+  template <class F>
+  void take_bucket(const size_t bucket_id, const F& handler) {
+    auto& entry = get_bucket_entry(bucket_id);
+    const size_t hash_value = entry.get_hash_value(hasher);
+    handler(std::move(entry.key), hash_value);
+  }
+
+  // Removes the keys for which predicate(const K& key) is true in a single sweep and returns the
+  // number removed.
+  template <class F>
+  size_t erase_if(const F& predicate) {
+    return erase_entries_if(
+        [&](const HashEntry<K, void, H>& entry) { return predicate(entry.key); });
+  }
+
+  using BareHashContainer<K, void, H, P, A>::max_load_factor;
 
-  using BareHashContainer<K, void, H>::reserve_n_buckets;
+  using BareHashContainer<K, void, H, P, A>::reserve_n_buckets;
 
  protected:
-  using BareHashContainer<K, void, H>::n_keys;
+  using BareHashContainer<K, void, H, P, A>::n_keys;
+
+  using BareHashContainer<K, void, H, P, A>::n_buckets;
+
+  using BareHashContainer<K, void, H, P, A>::hasher;
+
+  using BareHashContainer<K, void, H, P, A>::buckets;
+
+  using BareHashContainer<K, void, H, P, A>::old_buckets;
+
+  using BareHashContainer<K, void, H, P, A>::check_balance;
 
-  using BareHashContainer<K, void, H>::n_buckets;
+  using BareHashContainer<K, void, H, P, A>::probe;
 
-  using BareHashContainer<K, void, H>::buckets;
+  using BareHashContainer<K, void, H, P, A>::claim_bucket;
 
-  using BareHashContainer<K, void, H>::check_balance;
+  using BareHashContainer<K, void, H, P, A>::probe_old;
+
+  using BareHashContainer<K, void, H, P, A>::grow;
+
+  using BareHashContainer<K, void, H, P, A>::rehash_step;
+
+  using BareHashContainer<K, void, H, P, A>::for_each_entry;
+
+  using BareHashContainer<K, void, H, P, A>::drain_entries;
+
+  using BareHashContainer<K, void, H, P, A>::get_bucket_entry;
+
+  using BareHashContainer<K, void, H, P, A>::erase_entries_if;
+
+ private:
+  template <class KF>
+  void set_entry(KF&& key, const size_t hash_value);
 };
 
-template <class K, class H>
-void BareSet<K, H>::set(const K& key, const size_t hash_value) {
-  size_t bucket_id = hash_value % n_buckets;
-  size_t n_probes = 0;
-  while (n_probes < n_buckets) {
-    if (!buckets.at(bucket_id).filled) {
-      buckets.at(bucket_id).fill(key, hash_value);
-      n_keys++;
-      if (n_buckets * max_load_factor <= n_keys) reserve_n_buckets(n_buckets * 2);
-      break;
-    } else if (buckets.at(bucket_id).hash_value == hash_value && buckets.at(bucket_id).key == key) {
-      break;
-    } else {
-      n_probes++;
-      bucket_id = (bucket_id + 1) % n_buckets;
-    }
+template <class K, class H, class P, class A>
+template <class KF>
+void BareSet<K, H, P, A>::set_entry(KF&& key, const size_t hash_value) {
+  assert((StoreHashValue<K, H>::value || hash_value == hasher(key)));
+  rehash_step();
+  size_t bucket_id;
+  size_t n_probes;
+  size_t old_bucket_id;
+  if (!probe(key, hash_value, bucket_id, n_probes) && !probe_old(key, hash_value, old_bucket_id)) {
+    bucket_id = claim_bucket(bucket_id, n_probes, hash_value);
+    buckets.at(bucket_id).fill(std::forward<KF>(key), hash_value);
+    n_keys++;
+    if (n_buckets * max_load_factor <= n_keys) grow();
   }
   check_balance(n_probes);
 }
 
-template <class K, class H>
-void BareSet<K, H>::for_each(
+template <class K, class H, class P, class A>
+void BareSet<K, H, P, A>::for_each(
     const std::function<void(const K& key, const size_t hash_value)>& handler) const {
-  if (n_keys == 0) return;
-  for (size_t i = 0; i < n_buckets; i++) {
-    if (buckets.at(i).filled) {
-      handler(buckets.at(i).key, buckets.at(i).hash_value);
-    }
-  }
+  for_each_entry([&](const HashEntry<K, void, H>& entry) {
+    handler(entry.key, entry.get_hash_value(hasher));
+  });
+}
+
+template <class K, class H, class P, class A>
+template <class F>
+void BareSet<K, H, P, A>::drain(const F& handler) {
+  drain_entries([&](HashEntry<K, void, H>& entry) {
+    const size_t hash_value = entry.get_hash_value(hasher);
+    handler(std::move(entry.key), hash_value);
+  });
 }
 }  // namespace hpmr
 
 namespace hps {
-template <class K, class H, class B>
-class Serializer<hpmr::BareSet<K, H>, B> {
+template <class K, class H, class P, class A, class B>
+class Serializer<hpmr::BareSet<K, H, P, A>, B> {
  public:
-  static void serialize(const hpmr::BareSet<K, H>& set, OutputBuffer<B>& buf) {
+  static void serialize(const hpmr::BareSet<K, H, P, A>& set, OutputBuffer<B>& buf) {
     set.serialize(buf);
   }
-  static void parse(hpmr::BareSet<K, H>& set, InputBuffer<B>& buf) { set.parse(buf); }
+  static void parse(hpmr::BareSet<K, H, P, A>& set, InputBuffer<B>& buf) { set.parse(buf); }
 };
 }  // namespace hps
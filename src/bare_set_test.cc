@@ -85,8 +85,10 @@ TEST(BareSetTest, LargeAutoRehashSetAndHas) {
   hpmr::BareSet<int> m;
   constexpr int N_KEYS = 1000000;
   std::hash<int> hasher;
-  for (int i = 0; i < N_KEYS; i++) m.set(i * i, hasher(i * i));
-  for (int i = 0; i < N_KEYS; i += 10) EXPECT_TRUE(m.has(i * i, hasher(i * i)));
+  // Squares wrap around in unsigned arithmetic, since signed overflow is undefined.
+  const auto& square = [](const int i) { return static_cast<int>(static_cast<unsigned>(i) * i); };
+  for (int i = 0; i < N_KEYS; i++) m.set(square(i), hasher(square(i)));
+  for (int i = 0; i < N_KEYS; i += 10) EXPECT_TRUE(m.has(square(i), hasher(square(i))));
 }
 
 TEST(BareSetTest, UnsetAndHas) {
@@ -164,3 +166,33 @@ TEST(BareSetTest, ToAndFromString) {
   EXPECT_TRUE(m2.has("aa", hasher("aa")));
   EXPECT_TRUE(m2.has("bbb", hasher("bbb")));
 }
+
+TEST(BareSetTest, PowerOfTwoBucketPolicy) {
+  hpmr::BareSet<int, std::hash<int>, hpmr::PowerOfTwoBucketPolicy> m;
+  constexpr int N_KEYS = 1000000;
+  std::hash<int> hasher;
+  for (int i = 0; i < N_KEYS; i++) m.set(i, hasher(i));
+  const size_t n_buckets = m.get_n_buckets();
+  EXPECT_EQ(n_buckets & (n_buckets - 1), 0);
+  for (int i = 0; i < N_KEYS; i += 10) EXPECT_TRUE(m.has(i, hasher(i)));
+  EXPECT_FALSE(m.has(N_KEYS, hasher(N_KEYS)));
+}
+
+TEST(BareSetTest, HashValueElision) {
+  typedef hpmr::ComputedHash<std::hash<long long>> ComputedHash;
+  EXPECT_FALSE((hpmr::StoreHashValue<long long, ComputedHash>::value));
+  EXPECT_TRUE((hpmr::StoreHashValue<long long, std::hash<long long>>::value));
+  typedef hpmr::ComputedHash<std::hash<std::string>> ComputedStringHash;
+  EXPECT_TRUE((hpmr::StoreHashValue<std::string, ComputedStringHash>::value));
+  EXPECT_EQ(sizeof(hpmr::HashEntry<long long, void, ComputedHash>), sizeof(long long));
+  hpmr::BareSet<long long, ComputedHash> m1;
+  constexpr long long N_KEYS = 1000;
+  std::hash<long long> hasher;
+  for (long long i = 0; i < N_KEYS; i++) m1.set(i * i, hasher(i * i));
+  for (long long i = 0; i < N_KEYS; i += 2) m1.unset(i * i, hasher(i * i));
+  const std::string serialized = hps::serialize_to_string(m1);
+  hpmr::BareSet<long long, ComputedHash> m2;
+  hps::parse_from_string(m2, serialized);
+  EXPECT_EQ(m2.get_n_keys(), N_KEYS / 2);
+  for (long long i = 0; i < N_KEYS; i++) EXPECT_EQ(m2.has(i * i, hasher(i * i)), i % 2 == 1);
+}
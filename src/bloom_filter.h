@@ -0,0 +1,162 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "hash.h"
+
+namespace hpmr {
+// A split block Bloom filter. A key sets one bit in each of the eight words of one 64 byte block,
+// so a lookup reads a single cache line. Words are atomic, so lookups may run concurrently with
+// one inserting thread.
+class BloomFilter {
+ public:
+  constexpr static size_t N_BLOCK_WORDS = 8;
+
+  constexpr static size_t BLOCK_SIZE = N_BLOCK_WORDS * sizeof(uint64_t);
+
+  // Sized to about n_bits_min bits, rounded up to a power of two blocks.
+  explicit BloomFilter(const size_t n_bits_min);
+
+  // Must not be called by two threads at once.
+  void insert(const size_t hash_value) {
+    const uint64_t mixed = mix_hash(hash_value);
+    Block& block = blocks[(mixed >> 32) & block_mask];
+    const uint32_t bit_seed = static_cast<uint32_t>(mixed);
+    for (size_t i = 0; i < N_BLOCK_WORDS; i++) {
+      auto& word = block.words[i];
+      const uint64_t bits = word.load(std::memory_order_relaxed) | get_bit(bit_seed, i);
+      word.store(bits, std::memory_order_relaxed);
+    }
+  }
+
+  // False only if no key with the hash value has been inserted.
+  bool may_contain(const size_t hash_value) const {
+    const uint64_t mixed = mix_hash(hash_value);
+    const Block& block = blocks[(mixed >> 32) & block_mask];
+    const uint32_t bit_seed = static_cast<uint32_t>(mixed);
+    for (size_t i = 0; i < N_BLOCK_WORDS; i++) {
+      const uint64_t bit = get_bit(bit_seed, i);
+      if ((block.words[i].load(std::memory_order_relaxed) & bit) == 0) return false;
+    }
+    return true;
+  }
+
+ private:
+  struct Block {
+    std::atomic<uint64_t> words[N_BLOCK_WORDS];
+  };
+
+  // One extra block so that blocks can start on a cache line.
+  std::unique_ptr<Block[]> storage;
+
+  Block* blocks;
+
+  size_t block_mask;
+
+  static uint64_t get_bit(const uint32_t bit_seed, const size_t word_id) {
+    constexpr uint32_t SALTS[N_BLOCK_WORDS] = {
+        0x47B6137BU,
+        0x44974D91U,
+        0x8824AD5BU,
+        0xA2B7289DU,
+        0x705495C7U,
+        0x2DF1424BU,
+        0x9EFC4947U,
+        0x5C6BFB31U};
+    return 1ULL << ((bit_seed * SALTS[word_id]) >> 26);
+  }
+};
+
+inline BloomFilter::BloomFilter(const size_t n_bits_min) {
+  size_t n_blocks = 1;
+  while (n_blocks * BLOCK_SIZE * 8 < n_bits_min) n_blocks <<= 1;
+  block_mask = n_blocks - 1;
+  storage.reset(new Block[n_blocks + 1]());
+  const uintptr_t address = reinterpret_cast<uintptr_t>(storage.get());
+  blocks = reinterpret_cast<Block*>((address + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE);
+}
+
+// The Bloom filter of one segment of a concurrent container, which lets lookups of absent keys
+// return without taking the segment lock or touching the buckets. Lookups read it without the
+// lock, while inserts and rebuilds happen under the segment lock. A rebuilt filter replaces the
+// current one atomically and the replaced ones are kept until reset, since lookups may still be
+// reading them. Filters are only rebuilt when the segment grows, so the replaced ones take about as
+// much memory as the current one. Bits of unset keys stay until the next rebuild.
+class SegmentBloomFilter {
+ public:
+  // Bits per bucket of the segment, which is about 11 bits per key at the default load factor.
+  constexpr static size_t N_BITS_PER_BUCKET = 8;
+
+  // Segments with fewer buckets are not filtered, since their buckets likely stay in cache.
+  constexpr static size_t MIN_N_BUCKETS = 1 << 14;
+
+  SegmentBloomFilter() : filter(nullptr), enabled(false), n_buckets(0) {}
+
+  // Copies keep whether the filter is enabled, and are built by reset.
+  SegmentBloomFilter(const SegmentBloomFilter& f)
+      : filter(nullptr), enabled(f.enabled), n_buckets(0) {}
+
+  bool may_contain(const size_t hash_value) const {
+    const BloomFilter* current = filter.load(std::memory_order_acquire);
+    return current == nullptr || current->may_contain(hash_value);
+  }
+
+  // Records a key just inserted into the segment, rebuilding the filter if the segment has been
+  // resized since the last build.
+  template <class S>
+  void insert(const size_t hash_value, const S& segment) {
+    if (!enabled) return;
+    if (segment.get_n_buckets() != n_buckets) {
+      rebuild(segment);
+      return;
+    }
+    BloomFilter* current = filter.load(std::memory_order_relaxed);
+    if (current != nullptr) current->insert(hash_value);
+  }
+
+  // Replaces the filter with one built from the keys of the segment.
+  template <class S>
+  void rebuild(const S& segment);
+
+  // Also frees the replaced filters, so no lookup may run concurrently.
+  template <class S>
+  void reset(const S& segment) {
+    filter.store(nullptr, std::memory_order_relaxed);
+    filters.clear();
+    rebuild(segment);
+  }
+
+  template <class S>
+  void set_enabled(const bool enabled, const S& segment) {
+    this->enabled = enabled;
+    reset(segment);
+  }
+
+ private:
+  std::atomic<BloomFilter*> filter;
+
+  // The current filter and the replaced ones.
+  std::vector<std::unique_ptr<BloomFilter>> filters;
+
+  bool enabled;
+
+  // Number of buckets of the segment when the filter was built.
+  size_t n_buckets;
+};
+
+template <class S>
+void SegmentBloomFilter::rebuild(const S& segment) {
+  n_buckets = segment.get_n_buckets();
+  if (!enabled || n_buckets < MIN_N_BUCKETS) {
+    filter.store(nullptr, std::memory_order_release);
+    return;
+  }
+  std::unique_ptr<BloomFilter> rebuilt(new BloomFilter(n_buckets * N_BITS_PER_BUCKET));
+  segment.for_each_hash_value([&](const size_t hash_value) { rebuilt->insert(hash_value); });
+  filter.store(rebuilt.get(), std::memory_order_release);
+  filters.push_back(std::move(rebuilt));
+}
+}  // namespace hpmr
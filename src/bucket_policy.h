@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstddef>
+
+namespace hpmr {
+// Bucket count sizing, bucket id reduction, probing scheme and growth for the linear probing
+// containers.
+
+// Prime product bucket counts with modulo reduction. Works well with weak hash functions.
+class PrimeBucketPolicy {
+ public:
+  constexpr static bool ROBIN_HOOD = false;
+
+  // Zero rehashes all the buckets at once when the table grows.
+  constexpr static size_t N_REHASH_STEP_BUCKETS = 0;
+
+  static size_t get_n_initial_buckets() { return 11; }
+
+  // The smallest supported bucket count that is no less than n_buckets_min.
+  static size_t get_n_buckets(const size_t n_buckets_min);
+
+  static size_t get_bucket_id(const size_t hash_value, const size_t n_buckets) {
+    return hash_value % n_buckets;
+  }
+
+  static size_t get_next_bucket_id(const size_t bucket_id, const size_t n_buckets) {
+    return bucket_id + 1 == n_buckets ? 0 : bucket_id + 1;
+  }
+};
+
+// Power of two bucket counts with multiply-shift reduction, which needs no division.
+// The hash value is folded and multiplied by the golden ratio before taking the high bits, so
+// hash values that only differ in their high or low bits still spread over the buckets.
+class PowerOfTwoBucketPolicy {
+ public:
+  constexpr static bool ROBIN_HOOD = false;
+
+  // Zero rehashes all the buckets at once when the table grows.
+  constexpr static size_t N_REHASH_STEP_BUCKETS = 0;
+
+  static size_t get_n_initial_buckets() { return 16; }
+
+  static size_t get_n_buckets(const size_t n_buckets_min) {
+    size_t n_buckets = get_n_initial_buckets();
+    while (n_buckets < n_buckets_min) n_buckets <<= 1;
+    return n_buckets;
+  }
+
+  static size_t get_bucket_id(const size_t hash_value, const size_t n_buckets) {
+    const unsigned long long folded = hash_value ^ (hash_value >> 32);
+    const int shift = 64 - __builtin_ctzll(n_buckets);
+    return static_cast<size_t>((folded * 0x9E3779B97F4A7C15ULL) >> shift);
+  }
+
+  static size_t get_next_bucket_id(const size_t bucket_id, const size_t n_buckets) {
+    return (bucket_id + 1) & (n_buckets - 1);
+  }
+};
+
+// Robin Hood probing with the bucket counts of P. Entries are kept ordered by their probe distance,
+// so lookups stop at the first entry closer to its home bucket than the probe, and unset shifts
+// the following entries backward instead of searching for a replacement. This keeps misses short
+// at max load factors of 0.85 to 0.9.
+template <class P = PrimeBucketPolicy>
+class RobinHoodBucketPolicy : public P {
+ public:
+  constexpr static bool ROBIN_HOOD = true;
+};
+
+// Incremental rehash with the bucket counts and probing scheme of P. When the table grows, the old
+// buckets are kept beside the new ones and each set or unset moves the next N_STEP old buckets, so
+// no single operation pays for the whole rehash. Lookups check both tables until the move is done.
+template <class P = PrimeBucketPolicy, size_t N_STEP = 16>
+class IncrementalRehashBucketPolicy : public P {
+ public:
+  static_assert(N_STEP >= 2, "The old buckets must be moved before the new table fills up.");
+
+  constexpr static size_t N_REHASH_STEP_BUCKETS = N_STEP;
+};
+
+inline size_t PrimeBucketPolicy::get_n_buckets(const size_t n_buckets_min) {
+  constexpr size_t PRIMES[] = {
+      11, 17, 29, 47, 79, 127, 211, 337, 547, 887, 1433, 2311, 3739, 6053, 9791, 15859};
+  constexpr size_t N_PRIMES = sizeof(PRIMES) / sizeof(size_t);
+  constexpr size_t LAST_PRIME = PRIMES[N_PRIMES - 1];
+  constexpr size_t BIG_PRIME = PRIMES[N_PRIMES - 5];
+  size_t remaining_factor = n_buckets_min + n_buckets_min / 4;
+  size_t n_buckets = 1;
+  while (remaining_factor > LAST_PRIME) {
+    remaining_factor /= BIG_PRIME;
+    n_buckets *= BIG_PRIME;
+  }
+
+  // Find a prime larger than or equal to the remaining factor with binary search.
+  size_t left = 0, right = N_PRIMES - 1;
+  while (left < right) {
+    size_t mid = (left + right) / 2;
+    if (PRIMES[mid] < remaining_factor) {
+      left = mid + 1;
+    } else {
+      right = mid;
+    }
+  }
+  n_buckets *= PRIMES[left];
+  return n_buckets;
+}
+}  // namespace hpmr
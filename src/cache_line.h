@@ -0,0 +1,130 @@
+#pragma once
+
+#include <omp.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <vector>
+
+namespace hpmr {
+constexpr size_t CACHE_LINE_SIZE = 64;
+
+// Allocates arrays starting on a cache line. std::allocator only aligns to alignof(max_align_t)
+// before C++17, which would let the cache line padded types below straddle lines.
+template <class T>
+class CacheLineAllocator {
+ public:
+  typedef T value_type;
+
+  CacheLineAllocator() {}
+
+  template <class U>
+  CacheLineAllocator(const CacheLineAllocator<U>&) {}
+
+  T* allocate(const size_t n) {
+    void* ptr;
+    if (posix_memalign(&ptr, CACHE_LINE_SIZE, n * sizeof(T)) != 0) throw std::bad_alloc();
+    return static_cast<T*>(ptr);
+  }
+
+  void deallocate(T* ptr, const size_t) { free(ptr); }
+};
+
+template <class T, class U>
+bool operator==(const CacheLineAllocator<T>&, const CacheLineAllocator<U>&) {
+  return true;
+}
+
+template <class T, class U>
+bool operator!=(const CacheLineAllocator<T>&, const CacheLineAllocator<U>&) {
+  return false;
+}
+
+// A T padded to whole cache lines, so that neighbours in a CacheLineVector never share a line, for
+// per thread state written by its thread only.
+template <class T>
+class alignas(CACHE_LINE_SIZE) CacheLinePadded : public T {};
+
+template <class T>
+using CacheLineVector = std::vector<T, CacheLineAllocator<T>>;
+
+// A segment of a concurrent container together with its lock. Taking the lock brings in the table
+// header on the same lines, and no two segments share a line, so threads working on neighbouring
+// segments do not invalidate each other's lines. The lock is also a sequence lock: its sequence
+// number is odd while a writer holds it, so readers can skip the lock and retry if one overlapped.
+template <class S>
+class alignas(CACHE_LINE_SIZE) LockedSegment : public S {
+ public:
+  LockedSegment() : seq(0) { omp_init_lock(&segment_lock); }
+
+  // Copies the table and starts with a new lock.
+  LockedSegment(const LockedSegment& s) : S(s), seq(0) { omp_init_lock(&segment_lock); }
+
+  LockedSegment& operator=(const LockedSegment& s) {
+    S::operator=(s);
+    return *this;
+  }
+
+  ~LockedSegment() { omp_destroy_lock(&segment_lock); }
+
+  void lock() {
+    omp_set_lock(&segment_lock);
+    begin_write();
+  }
+
+  bool try_lock() {
+    if (!omp_test_lock(&segment_lock)) return false;
+    begin_write();
+    return true;
+  }
+
+  void unlock() {
+    seq.store(seq.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    omp_unset_lock(&segment_lock);
+  }
+
+  // Returns the sequence number to pass to validate_read after reading without the lock.
+  uint64_t begin_read() const { return seq.load(std::memory_order_acquire); }
+
+  // Whether no writer held the lock since begin_read returned read_seq, in which case everything
+  // read in between is consistent.
+  bool validate_read(const uint64_t read_seq) const {
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return (read_seq & 1) == 0 && seq.load(std::memory_order_relaxed) == read_seq;
+  }
+
+  S& get_table() { return *this; }
+
+  const S& get_table() const { return *this; }
+
+ private:
+  omp_lock_t segment_lock;
+
+  std::atomic<uint64_t> seq;
+
+  void begin_write() {
+    seq.store(seq.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+  }
+};
+
+// Segments per thread by default, which keeps lock contention low.
+constexpr size_t N_SEGMENTS_PER_THREAD = 8;
+
+// Keys per segment the default number of segments aims at for large containers, which keeps
+// rehashing a segment under its lock short.
+constexpr size_t N_SEGMENT_KEYS_TARGET = 1 << 20;
+
+// The smallest power of two that is at least N_SEGMENTS_PER_THREAD per thread and
+// n_keys_est / N_SEGMENT_KEYS_TARGET.
+inline size_t get_default_n_segments(const size_t n_keys_est = 0) {
+  const size_t n_segments_min =
+      std::max(omp_get_max_threads() * N_SEGMENTS_PER_THREAD, n_keys_est / N_SEGMENT_KEYS_TARGET);
+  size_t n_segments = 1;
+  while (n_segments < n_segments_min) n_segments <<= 1;
+  return n_segments;
+}
+}  // namespace hpmr
@@ -0,0 +1,80 @@
+#include "cache_line.h"
+
+#include <gtest/gtest.h>
+#include <omp.h>
+#include <cstdint>
+#include <vector>
+#include "bare_map.h"
+
+namespace {
+// A segment laid out without padding, so that the lock and table header of neighbouring segments
+// share cache lines.
+class UnpaddedSegment : public hpmr::BareMap<int, int> {
+ public:
+  UnpaddedSegment() { omp_init_lock(&segment_lock); }
+
+  UnpaddedSegment(const UnpaddedSegment& s) : hpmr::BareMap<int, int>(s) {
+    omp_init_lock(&segment_lock);
+  }
+
+  ~UnpaddedSegment() { omp_destroy_lock(&segment_lock); }
+
+  void lock() { omp_set_lock(&segment_lock); }
+
+  void unlock() { omp_unset_lock(&segment_lock); }
+
+ private:
+  omp_lock_t segment_lock;
+};
+
+// Each thread locks and writes its own segment, next to the segments of the other threads.
+template <class V>
+void set_in_own_segments(V& segments) {
+  constexpr int N_SETS = 10000000;
+  constexpr int N_KEYS = 1024;
+  hpmr::Hash<int> hasher;
+#pragma omp parallel
+  {
+    auto& segment = segments[omp_get_thread_num()];
+    for (int i = 0; i < N_SETS; i++) {
+      const int key = i % N_KEYS;
+      segment.lock();
+      segment.set(key, hasher(key), i);
+      segment.unlock();
+    }
+  }
+  for (const auto& segment : segments) EXPECT_EQ(segment.get_n_keys(), N_KEYS);
+}
+}  // namespace
+
+TEST(CacheLineTest, PaddedSlotsDoNotShareLines) {
+  hpmr::CacheLineVector<hpmr::CacheLinePadded<hpmr::BareMap<int, int>>> caches(3);
+  EXPECT_EQ(sizeof(caches[0]) % hpmr::CACHE_LINE_SIZE, 0);
+  for (const auto& cache : caches) {
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(&cache) % hpmr::CACHE_LINE_SIZE, 0);
+  }
+}
+
+TEST(CacheLineTest, LockedSegmentCopy) {
+  hpmr::CacheLineVector<hpmr::LockedSegment<hpmr::BareMap<int, int>>> segments(2);
+  hpmr::Hash<int> hasher;
+  segments[0].lock();
+  segments[0].set(1, hasher(1), 2);
+  hpmr::LockedSegment<hpmr::BareMap<int, int>> copy(segments[0]);
+  EXPECT_TRUE(copy.try_lock());
+  copy.unlock();
+  segments[0].unlock();
+  EXPECT_EQ(copy.get(1, hasher(1)), 2);
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(&segments[1]) % hpmr::CACHE_LINE_SIZE, 0);
+}
+
+TEST(CacheLineTest, LargeContendedPaddedSegments) {
+  hpmr::CacheLineVector<hpmr::LockedSegment<hpmr::BareMap<int, int>>> segments(
+      omp_get_max_threads());
+  set_in_own_segments(segments);
+}
+
+TEST(CacheLineTest, LargeContendedUnpaddedSegmentsComparison) {
+  std::vector<UnpaddedSegment> segments(omp_get_max_threads());
+  set_in_own_segments(segments);
+}
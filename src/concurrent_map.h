@@ -4,11 +4,18 @@
 
 #include "bare_concurrent_map.h"
 #include "dist_map.h"
+#include "frozen_map.h"
 #include "reducer.h"
 
 namespace hpmr {
 
-template <class K, class V, class H = std::hash<K>>
+template <
+    class K,
+    class V,
+    class H = Hash<K>,
+    class P = PrimeBucketPolicy,
+    class A = std::allocator<char>,
+    class CA = A>
 class ConcurrentMap {
  public:
   void reserve(const size_t n_keys_min) { bare_map.reserve(n_keys_min); }
@@ -25,32 +32,69 @@ class ConcurrentMap {
     bare_map.set_max_load_factor(max_load_factor);
   }
 
-  void set(
-      const K& key,
-      const V& value,
-      const std::function<void(V&, const V&)>& reducer = Reducer<V>::overwrite) {
+  void set_bloom_filter(const bool enabled) { bare_map.set_bloom_filter(enabled); }
+
+  void set_optimistic_reads(const bool enabled) { bare_map.set_optimistic_reads(enabled); }
+
+  // Caps the memory of the entries async_set caches per thread, see
+  // BareConcurrentMap::set_thread_cache_budget.
+  void set_thread_cache_budget(const size_t n_bytes) { bare_map.set_thread_cache_budget(n_bytes); }
+
+  // Batches async_set per segment, see BareConcurrentMap::set_write_combining.
+  void set_write_combining(const size_t n_buffer_keys) {
+    bare_map.set_write_combining(n_buffer_keys);
+  }
+
+  // Reducers are taken by type like BareMap::set.
+  template <class R = typename Reducer<V>::Overwrite>
+  void set(const K& key, const V& value, const R& reducer = R()) {
     bare_map.set(key, hasher(key), value, reducer);
   }
 
-  void async_set(
-      const K& key,
-      const V& value,
-      const std::function<void(V&, const V&)>& reducer = Reducer<V>::overwrite) {
+  // Moves the key and the value in if the key is new.
+  template <class R = typename Reducer<V>::Overwrite>
+  void set(K&& key, V&& value, const R& reducer = R()) {
+    const size_t hash_value = hasher(key);
+    bare_map.set(std::move(key), hash_value, std::move(value), reducer);
+  }
+
+  template <class R = typename Reducer<V>::Overwrite>
+  void async_set(const K& key, const V& value, const R& reducer = R()) {
     bare_map.async_set(key, hasher(key), value, reducer);
   }
 
-  void sync(const std::function<void(V&, const V&)>& reducer = Reducer<V>::overwrite) {
-    bare_map.sync(reducer);
+  template <class R = typename Reducer<V>::Overwrite>
+  void async_set(K&& key, V&& value, const R& reducer = R()) {
+    const size_t hash_value = hasher(key);
+    bare_map.async_set(std::move(key), hash_value, std::move(value), reducer);
   }
 
+  template <class R = typename Reducer<V>::Overwrite>
+  void sync(const R& reducer = R()) { bare_map.sync(reducer); }
+
   V get(const K& key, const V& default_value = V()) {
     return bare_map.get(key, hasher(key), default_value);
   }
 
+  // Takes keys of other types when the hasher is transparent.
+  template <class KL, class = EnableIfLookupKey<K, KL, H>>
+  V get(const KL& key, const V& default_value = V()) {
+    return bare_map.get(key, hasher(key), default_value);
+  }
+
   void unset(const K& key) { bare_map.unset(key, hasher(key)); }
 
+  template <class KL, class = EnableIfLookupKey<K, KL, H>>
+  void unset(const KL& key) { bare_map.unset(key, hasher(key)); }
+
   bool has(const K& key) { return bare_map.has(key, hasher(key)); }
 
+  template <class KL, class = EnableIfLookupKey<K, KL, H>>
+  bool has(const KL& key) { return bare_map.has(key, hasher(key)); }
+
+  template <class F>
+  size_t erase_if(const F& predicate) { return bare_map.erase_if(predicate); }
+
   void clear() { bare_map.clear(); }
 
   void clear_and_shrink() { bare_map.clear_and_shrink(); }
@@ -61,6 +105,8 @@ class ConcurrentMap {
     bare_map.for_each(handler, verbose);
   }
 
+  FrozenMap<K, V, H, A> freeze() const { return bare_map.template freeze<FrozenMap<K, V, H, A>>(); }
+
   // TODO: convert to dist map.
 
   // TODO: local mapreduce to a new concurrent map.
@@ -68,7 +114,7 @@ class ConcurrentMap {
  private:
   H hasher;
 
-  BareConcurrentMap<K, V, H> bare_map;
+  BareConcurrentMap<K, V, ComputedHash<H>, P, A, CA> bare_map;
 };
 
 }  // namespace hpmr
\ No newline at end of file
@@ -2,6 +2,7 @@
 
 #include <gtest/gtest.h>
 #include "reducer.h"
+#include "hash.h"
 
 TEST(ConcurrentMapTest, Initialization) {
   hpmr::ConcurrentMap<std::string, int> m;
@@ -108,3 +109,43 @@ TEST(ConcurrentMapTest, ClearAndShrink) {
   EXPECT_EQ(m.get_n_keys(), 0);
   EXPECT_LT(m.get_n_buckets(), N_KEYS * m.get_max_load_factor());
 }
+
+TEST(ConcurrentMapTest, TransparentLookup) {
+  hpmr::ConcurrentMap<std::string, int, hpmr::StringHash> m;
+  m.set("aa", 1);
+  m.set(std::string("bbbbbbbbbbbb"), 2);
+  const char* key = "bbbbbbbbbbbb";
+  EXPECT_TRUE(m.has(key));
+  EXPECT_EQ(m.get(key), 2);
+  EXPECT_EQ(m.get("aa"), 1);
+  EXPECT_EQ(m.get(std::string("aa")), 1);
+  EXPECT_FALSE(m.has("cc"));
+  m.unset(key);
+  EXPECT_FALSE(m.has(std::string(key)));
+  EXPECT_EQ(m.get_n_keys(), 1);
+}
+
+TEST(ConcurrentMapTest, Freeze) {
+  hpmr::ConcurrentMap<std::string, int> m;
+  constexpr int N_KEYS = 100000;
+#pragma omp parallel for
+  for (int i = 0; i < N_KEYS; i++) m.async_set(std::to_string(i), i);
+  m.sync();
+  const auto& frozen_map = m.freeze();
+  EXPECT_EQ(frozen_map.get_n_keys(), N_KEYS);
+  int n_wrong_values = 0;
+#pragma omp parallel for reduction(+ : n_wrong_values)
+  for (int i = 0; i < N_KEYS * 2; i++) {
+    const auto& key = std::to_string(i);
+    if (frozen_map.has(key) != (i < N_KEYS)) n_wrong_values++;
+    if (frozen_map.get(key, -1) != (i < N_KEYS ? i : -1)) n_wrong_values++;
+  }
+  EXPECT_EQ(n_wrong_values, 0);
+  EXPECT_EQ(frozen_map.get("123"), 123);
+  size_t n_keys = 0;
+  frozen_map.for_each([&](const std::string& key, const int value) {
+    EXPECT_EQ(key, std::to_string(value));
+    n_keys++;
+  });
+  EXPECT_EQ(n_keys, N_KEYS);
+}
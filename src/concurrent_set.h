@@ -4,16 +4,38 @@
 
 namespace hpmr {
 
-template <class K, class H = std::hash<K>>
-class ConcurrentSet : public BareConcurrentSet<K, H> {
+template <
+    class K,
+    class H = Hash<K>,
+    class P = PrimeBucketPolicy,
+    class A = std::allocator<char>,
+    class CA = A>
+class ConcurrentSet : public BareConcurrentSet<K, ComputedHash<H>, P, A, CA> {
  public:
-  void set(const K& key) { BareConcurrentSet<K, H>::set(key, hasher(key)); }
-
-  void async_set(const K& key) { BareConcurrentSet<K, H>::async_set(key, hasher(key)); }
-
-  void unset(const K& key) { BareConcurrentSet<K, H>::unset(key, hasher(key)); }
-
-  bool has(const K& key) { return BareConcurrentSet<K, H>::has(key, hasher(key)); }
+  void set(const K& key) { BareConcurrentSet<K, ComputedHash<H>, P, A, CA>::set(key, hasher(key)); }
+
+  void async_set(const K& key) {
+    BareConcurrentSet<K, ComputedHash<H>, P, A, CA>::async_set(key, hasher(key));
+  }
+
+  void unset(const K& key) {
+    BareConcurrentSet<K, ComputedHash<H>, P, A, CA>::unset(key, hasher(key));
+  }
+
+  // Takes keys of other types when the hasher is transparent.
+  template <class KL, class = EnableIfLookupKey<K, KL, H>>
+  void unset(const KL& key) {
+    BareConcurrentSet<K, ComputedHash<H>, P, A, CA>::unset(key, hasher(key));
+  }
+
+  bool has(const K& key) {
+    return BareConcurrentSet<K, ComputedHash<H>, P, A, CA>::has(key, hasher(key));
+  }
+
+  template <class KL, class = EnableIfLookupKey<K, KL, H>>
+  bool has(const KL& key) {
+    return BareConcurrentSet<K, ComputedHash<H>, P, A, CA>::has(key, hasher(key));
+  }
 
  private:
   H hasher;
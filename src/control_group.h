@@ -0,0 +1,142 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace hpmr {
+// A group of consecutive control bytes scanned with one vector compare.
+// Each control byte is either EMPTY or the 7 bit tag of the hash value stored in the bucket.
+// Under Robin Hood probing the control byte holds the probe distance of the entry instead.
+// The control bytes are the only record of which buckets are filled.
+class ControlGroup {
+ public:
+#if defined(__AVX2__)
+  constexpr static size_t SIZE = 32;
+#else
+  constexpr static size_t SIZE = 16;
+#endif
+
+  constexpr static uint8_t EMPTY = 0x80;
+
+  // An entry removed from a table that is being rehashed incrementally. Not a stop for probing.
+  constexpr static uint8_t DELETED = 0xFE;
+
+  // Largest probe distance so that first + i in the sequence matches below stays under 128.
+  constexpr static uint8_t MAX_DISTANCE = 128 - SIZE;
+
+  static uint8_t get_tag(const size_t hash_value) {
+    return static_cast<uint8_t>((hash_value * 0xC2B2AE3D27D4EB4FULL) >> 57);
+  }
+
+  // Tags and probe distances have the high bit clear, the special control bytes have it set.
+  static bool is_full(const uint8_t ctrl_byte) { return ctrl_byte < EMPTY; }
+
+  explicit ControlGroup(const uint8_t* ctrl);
+
+  // Bit i of the result is set if the i-th control byte of the group equals ctrl_byte.
+  uint32_t match(const uint8_t ctrl_byte) const;
+
+  uint32_t match_empty() const { return match(EMPTY); }
+
+  // Bit i is set if the i-th control byte equals first + i, i.e. the entry there has the same home
+  // bucket as an entry at distance first from the group start.
+  uint32_t match_sequence(const uint8_t first) const;
+
+  // Bit i is set if the i-th control byte is EMPTY or less than first + i.
+  uint32_t match_below_sequence(const uint8_t first) const;
+
+ private:
+#if defined(__AVX2__)
+  __m256i group;
+#elif defined(__SSE2__)
+  __m128i group;
+#else
+  const uint8_t* group;
+#endif
+};
+
+#if defined(__AVX2__)
+inline ControlGroup::ControlGroup(const uint8_t* ctrl) {
+  group = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ctrl));
+}
+
+inline uint32_t ControlGroup::match(const uint8_t ctrl_byte) const {
+  const __m256i target = _mm256_set1_epi8(static_cast<char>(ctrl_byte));
+  return static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(group, target)));
+}
+
+inline uint32_t ControlGroup::match_sequence(const uint8_t first) const {
+  const __m256i sequence = _mm256_add_epi8(
+      _mm256_set1_epi8(static_cast<char>(first)),
+      _mm256_setr_epi8(
+          0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+          16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31));
+  return static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(group, sequence)));
+}
+
+inline uint32_t ControlGroup::match_below_sequence(const uint8_t first) const {
+  const __m256i sequence = _mm256_add_epi8(
+      _mm256_set1_epi8(static_cast<char>(first)),
+      _mm256_setr_epi8(
+          0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+          16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31));
+  // EMPTY is negative as a signed byte, so it compares below any sequence value.
+  return static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpgt_epi8(sequence, group)));
+}
+#elif defined(__SSE2__)
+inline ControlGroup::ControlGroup(const uint8_t* ctrl) {
+  group = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ctrl));
+}
+
+inline uint32_t ControlGroup::match(const uint8_t ctrl_byte) const {
+  const __m128i target = _mm_set1_epi8(static_cast<char>(ctrl_byte));
+  return static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(group, target)));
+}
+
+inline uint32_t ControlGroup::match_sequence(const uint8_t first) const {
+  const __m128i sequence = _mm_add_epi8(
+      _mm_set1_epi8(static_cast<char>(first)),
+      _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+  return static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(group, sequence)));
+}
+
+inline uint32_t ControlGroup::match_below_sequence(const uint8_t first) const {
+  const __m128i sequence = _mm_add_epi8(
+      _mm_set1_epi8(static_cast<char>(first)),
+      _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+  // EMPTY is negative as a signed byte, so it compares below any sequence value.
+  return static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmplt_epi8(group, sequence)));
+}
+#else
+inline ControlGroup::ControlGroup(const uint8_t* ctrl) : group(ctrl) {}
+
+inline uint32_t ControlGroup::match(const uint8_t ctrl_byte) const {
+  uint32_t res = 0;
+  for (size_t i = 0; i < SIZE; i++) {
+    if (group[i] == ctrl_byte) res |= 1u << i;
+  }
+  return res;
+}
+
+inline uint32_t ControlGroup::match_sequence(const uint8_t first) const {
+  uint32_t res = 0;
+  for (size_t i = 0; i < SIZE; i++) {
+    if (group[i] == first + i) res |= 1u << i;
+  }
+  return res;
+}
+
+inline uint32_t ControlGroup::match_below_sequence(const uint8_t first) const {
+  uint32_t res = 0;
+  for (size_t i = 0; i < SIZE; i++) {
+    if (group[i] == EMPTY || group[i] < first + i) res |= 1u << i;
+  }
+  return res;
+}
+#endif
+}  // namespace hpmr
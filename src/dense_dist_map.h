@@ -0,0 +1,364 @@
+#pragma once
+
+#include <mpi.h>
+#include <omp.h>
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include "bare_concurrent_map.h"
+#include "dist_exchange.h"
+#include "dist_map.h"
+#include "mpi_type.h"
+#include "reducer.h"
+
+namespace hpmr {
+// A distributed map for integer keys in a known range [key_lo, key_hi). The range is split into one
+// contiguous block per process, and each process keeps the values of its block in an array with a
+// bitmap of which keys are present, so a key costs sizeof(V) plus one bit and a lookup is an index.
+// Values for keys of other processes are combined in hash maps until sync, like in DistMap.
+// The values are allocated with A and the buffers of the other processes with CA.
+template <class K, class V, class A = std::allocator<char>, class CA = A>
+class DenseDistMap {
+ public:
+  static_assert(std::is_integral<K>::value, "Keys of dense maps must be integers.");
+
+  // Local keys are guarded by this many locks per thread, each covering words of the bitmap.
+  constexpr static size_t N_LOCKS_PER_THREAD = 64;
+
+  DenseDistMap(const K key_lo, const K key_hi);
+
+  DenseDistMap(const DenseDistMap& m);
+
+  // Copies the entries and keeps the locks.
+  DenseDistMap& operator=(const DenseDistMap& m);
+
+  ~DenseDistMap();
+
+  K get_key_lo() const { return key_lo; }
+
+  K get_key_hi() const { return key_hi; }
+
+  size_t get_n_keys();
+
+  // Reducers are taken by type like BareMap::set. The key must be in [key_lo, key_hi), which is
+  // only asserted since async_set runs in parallel loops.
+  template <class R = typename Reducer<V>::Overwrite>
+  void async_set(const K key, const V& value, const R& reducer = R());
+
+  template <class R = typename Reducer<V>::Keep>
+  void sync(
+      const R& reducer = R(),
+      const bool verbose = false,
+      const int trunk_size = DEFAULT_TRUNK_SIZE);
+
+  // Throws std::out_of_range for keys outside of [key_lo, key_hi).
+  V get(const K key, const V& default_value = V());
+
+  template <class F>
+  size_t erase_if(const F& predicate);
+
+  void clear();
+
+  void clear_and_shrink();
+
+  template <class KR, class VR, class HR = Hash<KR>>
+  DistMap<KR, VR, HR, PrimeBucketPolicy, A, CA> mapreduce(
+      const std::function<
+          void(const K&, const V&, const std::function<void(const KR&, const VR&)>&)>& mapper,
+      const std::function<void(VR&, const VR&)>& reducer,
+      const bool verbose = false);
+
+ private:
+  template <class T>
+  using Vector = std::vector<T, typename std::allocator_traits<A>::template rebind_alloc<T>>;
+
+  // Offsets between keys are computed in the unsigned type, which does not overflow for ranges
+  // wider than the largest K.
+  typedef typename std::make_unsigned<K>::type UK;
+
+  constexpr static size_t N_WORD_BITS = 64;
+
+  constexpr static int DEFAULT_TRUNK_SIZE = 1 << 20;
+
+  int n_procs;
+
+  int proc_id;
+
+  K key_lo;
+
+  K key_hi;
+
+  // Number of keys in the block of each process, the last block may be shorter.
+  size_t n_block_keys;
+
+  // First key of the block of this process.
+  K local_key_lo;
+
+  size_t n_local_keys;
+
+  Vector<V> values;
+
+  // Bit i is set if the key local_key_lo + i is present.
+  Vector<uint64_t> filled;
+
+  std::vector<omp_lock_t> locks;
+
+  Hash<K> hasher;
+
+  std::vector<BareConcurrentMap<K, V, ComputedHash<Hash<K>>, PrimeBucketPolicy, CA, CA>>
+      remote_maps;
+
+  void init_locks();
+
+  bool in_range(const K key) const { return key >= key_lo && key < key_hi; }
+
+  // Distance of the key from key_lo.
+  size_t get_offset(const K key) const { return get_distance(key_lo, key); }
+
+  size_t get_distance(const K from, const K to) const {
+    return static_cast<size_t>(static_cast<UK>(static_cast<UK>(to) - static_cast<UK>(from)));
+  }
+
+  K get_local_key(const size_t local_id) const {
+    return static_cast<K>(static_cast<UK>(static_cast<UK>(local_key_lo) + local_id));
+  }
+
+  template <class R>
+  void set_local(const size_t local_id, const V& value, const R& reducer);
+
+  template <class F>
+  void for_each_local(const F& handler, const bool verbose);
+};
+
+template <class K, class V, class A, class CA>
+DenseDistMap<K, V, A, CA>::DenseDistMap(const K key_lo, const K key_hi)
+    : key_lo(key_lo), key_hi(key_hi) {
+  if (key_hi < key_lo) throw std::invalid_argument("key_hi is smaller than key_lo.");
+  MPI_Comm_size(MPI_COMM_WORLD, &n_procs);
+  MPI_Comm_rank(MPI_COMM_WORLD, &proc_id);
+  const size_t n_keys_range = get_offset(key_hi);
+  const size_t n_procs_u = static_cast<size_t>(n_procs);
+  n_block_keys = (n_keys_range + n_procs_u - 1) / n_procs_u;
+  const size_t local_offset = std::min(n_block_keys * proc_id, n_keys_range);
+  local_key_lo = static_cast<K>(static_cast<UK>(static_cast<UK>(key_lo) + local_offset));
+  n_local_keys = std::min(n_block_keys, n_keys_range - local_offset);
+  values.resize(n_local_keys);
+  filled.assign((n_local_keys + N_WORD_BITS - 1) / N_WORD_BITS, 0);
+  init_locks();
+  remote_maps.resize(n_procs);
+}
+
+template <class K, class V, class A, class CA>
+DenseDistMap<K, V, A, CA>::DenseDistMap(const DenseDistMap& m)
+    : n_procs(m.n_procs),
+      proc_id(m.proc_id),
+      key_lo(m.key_lo),
+      key_hi(m.key_hi),
+      n_block_keys(m.n_block_keys),
+      local_key_lo(m.local_key_lo),
+      n_local_keys(m.n_local_keys),
+      values(m.values),
+      filled(m.filled),
+      remote_maps(m.remote_maps) {
+  init_locks();
+}
+
+template <class K, class V, class A, class CA>
+DenseDistMap<K, V, A, CA>& DenseDistMap<K, V, A, CA>::operator=(const DenseDistMap& m) {
+  n_procs = m.n_procs;
+  proc_id = m.proc_id;
+  key_lo = m.key_lo;
+  key_hi = m.key_hi;
+  n_block_keys = m.n_block_keys;
+  local_key_lo = m.local_key_lo;
+  n_local_keys = m.n_local_keys;
+  values = m.values;
+  filled = m.filled;
+  // The concurrent maps are copy constructible but not assignable.
+  auto remote_maps_copy = m.remote_maps;
+  remote_maps.swap(remote_maps_copy);
+  return *this;
+}
+
+template <class K, class V, class A, class CA>
+DenseDistMap<K, V, A, CA>::~DenseDistMap() {
+  for (auto& lock : locks) omp_destroy_lock(&lock);
+}
+
+template <class K, class V, class A, class CA>
+void DenseDistMap<K, V, A, CA>::init_locks() {
+  locks.resize(omp_get_max_threads() * N_LOCKS_PER_THREAD);
+  for (auto& lock : locks) omp_init_lock(&lock);
+}
+
+template <class K, class V, class A, class CA>
+size_t DenseDistMap<K, V, A, CA>::get_n_keys() {
+  size_t local_n_keys = 0;
+  const size_t n_words = filled.size();
+#pragma omp parallel for reduction(+ : local_n_keys)
+  for (size_t i = 0; i < n_words; i++) local_n_keys += __builtin_popcountll(filled[i]);
+  size_t n_keys;
+  MPI_Allreduce(&local_n_keys, &n_keys, 1, MpiType<size_t>::value, MPI_SUM, MPI_COMM_WORLD);
+  return n_keys;
+}
+
+template <class K, class V, class A, class CA>
+template <class R>
+void DenseDistMap<K, V, A, CA>::async_set(const K key, const V& value, const R& reducer) {
+  assert(in_range(key));
+  const size_t offset = get_offset(key);
+  const int dest_proc_id = static_cast<int>(offset / n_block_keys);
+  if (dest_proc_id == proc_id) {
+    set_local(offset - n_block_keys * proc_id, value, reducer);
+  } else {
+    remote_maps[dest_proc_id].async_set(key, hasher(key), value, reducer);
+  }
+}
+
+template <class K, class V, class A, class CA>
+template <class R>
+void DenseDistMap<K, V, A, CA>::set_local(
+    const size_t local_id, const V& value, const R& reducer) {
+  const size_t word_id = local_id / N_WORD_BITS;
+  const uint64_t bit = 1ULL << (local_id % N_WORD_BITS);
+  auto& lock = locks[word_id % locks.size()];
+  omp_set_lock(&lock);
+  if (filled[word_id] & bit) {
+    reducer(values[local_id], value);
+  } else {
+    values[local_id] = value;
+    filled[word_id] |= bit;
+  }
+  omp_unset_lock(&lock);
+}
+
+template <class K, class V, class A, class CA>
+template <class R>
+void DenseDistMap<K, V, A, CA>::sync(const R& reducer, const bool verbose, const int trunk_size) {
+  assert(trunk_size > 0);
+  const bool report = proc_id == 0 && verbose;
+  if (report) printf("Syncing: ");
+
+  const auto& node_handler = [&](const K& key, const size_t, const V& value) {
+    set_local(get_distance(local_key_lo, key), value, reducer);
+  };
+
+  const auto& shuffled_procs = generate_shuffled_procs(n_procs, proc_id);
+  const int shuffled_id = get_shuffled_id(shuffled_procs, proc_id);
+
+  std::string send_buf;
+  std::string recv_buf;
+  for (int i = 1; i < n_procs; i++) {
+    const int dest_proc_id = shuffled_procs[(shuffled_id + i) % n_procs];
+    const int src_proc_id = shuffled_procs[(shuffled_id + n_procs - i) % n_procs];
+    remote_maps[dest_proc_id].sync(reducer);
+    send_buf = remote_maps[dest_proc_id].to_string();
+    remote_maps[dest_proc_id].clear();
+    exchange_string(send_buf, dest_proc_id, recv_buf, src_proc_id, trunk_size);
+    remote_maps[dest_proc_id].from_string(recv_buf);
+    remote_maps[dest_proc_id].for_each(node_handler);
+    remote_maps[dest_proc_id].clear();
+    if (report) printf("%d/%d ", i - 1, n_procs - 1);
+  }
+  if (report) printf("#\n");
+}
+
+template <class K, class V, class A, class CA>
+V DenseDistMap<K, V, A, CA>::get(const K key, const V& default_value) {
+  if (!in_range(key)) throw std::out_of_range("Key is out of the range of the dense map.");
+  const size_t offset = get_offset(key);
+  const int dest_proc_id = static_cast<int>(offset / n_block_keys);
+  V res;
+  if (dest_proc_id == proc_id) {
+    const size_t local_id = offset - n_block_keys * proc_id;
+    const bool has_key = filled[local_id / N_WORD_BITS] & (1ULL << (local_id % N_WORD_BITS));
+    res = has_key ? values[local_id] : default_value;
+  }
+  MPI_Bcast(&res, 1, MpiType<V>::value, dest_proc_id, MPI_COMM_WORLD);
+  return res;
+}
+
+template <class K, class V, class A, class CA>
+template <class F>
+size_t DenseDistMap<K, V, A, CA>::erase_if(const F& predicate) {
+  size_t local_n_erased = 0;
+  const size_t n_words = filled.size();
+#pragma omp parallel for schedule(static) reduction(+ : local_n_erased)
+  for (size_t i = 0; i < n_words; i++) {
+    uint64_t word = filled[i];
+    while (word != 0) {
+      const uint64_t bit = word & (~word + 1);
+      const size_t local_id = i * N_WORD_BITS + __builtin_ctzll(word);
+      if (predicate(get_local_key(local_id), values[local_id])) {
+        filled[i] &= ~bit;
+        local_n_erased++;
+      }
+      word ^= bit;
+    }
+  }
+  size_t n_erased;
+  MPI_Allreduce(&local_n_erased, &n_erased, 1, MpiType<size_t>::value, MPI_SUM, MPI_COMM_WORLD);
+  return n_erased;
+}
+
+template <class K, class V, class A, class CA>
+void DenseDistMap<K, V, A, CA>::clear() {
+  std::fill(filled.begin(), filled.end(), 0);
+  for (auto& remote_map : remote_maps) remote_map.clear();
+}
+
+template <class K, class V, class A, class CA>
+void DenseDistMap<K, V, A, CA>::clear_and_shrink() {
+  std::fill(filled.begin(), filled.end(), 0);
+  for (auto& remote_map : remote_maps) remote_map.clear_and_shrink();
+}
+
+template <class K, class V, class A, class CA>
+template <class F>
+void DenseDistMap<K, V, A, CA>::for_each_local(const F& handler, const bool verbose) {
+  const size_t n_words = filled.size();
+  const size_t n_report_words = n_words / 10 + 1;
+#pragma omp parallel for schedule(static, 1024)
+  for (size_t i = 0; i < n_words; i++) {
+    uint64_t word = filled[i];
+    while (word != 0) {
+      const size_t local_id = i * N_WORD_BITS + __builtin_ctzll(word);
+      handler(get_local_key(local_id), values[local_id]);
+      word &= word - 1;
+    }
+    if (verbose && omp_get_thread_num() == 0 && i % n_report_words == 0) {
+      printf("%zu/%zu ", i / n_report_words, n_words / n_report_words);
+    }
+  }
+  if (verbose) printf("#\n");
+}
+
+template <class K, class V, class A, class CA>
+template <class KR, class VR, class HR>
+DistMap<KR, VR, HR, PrimeBucketPolicy, A, CA> DenseDistMap<K, V, A, CA>::mapreduce(
+    const std::function<void(const K&, const V&, const std::function<void(const KR&, const VR&)>&)>&
+        mapper,
+    const std::function<void(VR&, const VR&)>& reducer,
+    const bool verbose) {
+  DistMap<KR, VR, HR, PrimeBucketPolicy, A, CA> res;
+
+  const bool report = verbose && proc_id == 0;
+  if (report) {
+    const int n_threads = omp_get_max_threads();
+    printf("MapReduce on %d (%dx) node(s):\nMapping: ", n_procs, n_threads);
+  }
+
+  const auto& emit = [&](const KR& key, const VR& value) { res.async_set(key, value, reducer); };
+  for_each_local([&](const K key, const V& value) { mapper(key, value, emit); }, report);
+
+  res.sync(reducer, verbose);
+
+  return res;
+}
+}  // namespace hpmr
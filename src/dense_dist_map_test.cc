@@ -0,0 +1,107 @@
+#include "dense_dist_map.h"
+
+#include <gtest/gtest.h>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include "reducer.h"
+
+TEST(DenseDistMapTest, Initialization) {
+  hpmr::DenseDistMap<int, int> m(-10, 100);
+  EXPECT_EQ(m.get_n_keys(), 0);
+  EXPECT_EQ(m.get_key_lo(), -10);
+  EXPECT_EQ(m.get_key_hi(), 100);
+}
+
+TEST(DenseDistMapTest, SetAndGet) {
+  hpmr::DenseDistMap<int, int> m(-10, 100);
+  m.async_set(-10, 1);
+  m.async_set(99, 2);
+  m.sync();
+  EXPECT_EQ(m.get_n_keys(), 2);
+  EXPECT_EQ(m.get(-10), 1);
+  EXPECT_EQ(m.get(99), 2);
+  EXPECT_EQ(m.get(0, -1), -1);
+  EXPECT_THROW(m.get(-11), std::out_of_range);
+}
+
+TEST(DenseDistMapTest, SyncKeepsByDefault) {
+  hpmr::DenseDistMap<int, int> m(0, 10);
+  int proc_id;
+  MPI_Comm_rank(MPI_COMM_WORLD, &proc_id);
+  // Process 0 owns key 0 and keeps its own value over the ones others send, like DistMap::sync.
+  m.async_set(0, proc_id + 1);
+  m.sync();
+  EXPECT_EQ(m.get(0), 1);
+}
+
+TEST(DenseDistMapTest, FullRangeOfKeys) {
+  hpmr::DenseDistMap<int8_t, int> m(INT8_MIN, INT8_MAX);
+  m.async_set(INT8_MIN, 1);
+  m.async_set(INT8_MAX - 1, 2);
+  m.async_set(0, 3);
+  m.sync();
+  EXPECT_EQ(m.get_n_keys(), 3);
+  EXPECT_EQ(m.get(INT8_MIN), 1);
+  EXPECT_EQ(m.get(INT8_MAX - 1), 2);
+  EXPECT_EQ(m.get(0), 3);
+  EXPECT_THROW(m.get(INT8_MAX), std::out_of_range);
+  const auto& is_negative = [](const int8_t key, const int) { return key < 0; };
+  EXPECT_EQ(m.erase_if(is_negative), 1);
+  EXPECT_EQ(m.get(INT8_MIN, -1), -1);
+  EXPECT_EQ(m.get(INT8_MAX - 1), 2);
+}
+
+TEST(DenseDistMapTest, CopyAssignment) {
+  hpmr::DenseDistMap<int, int> m(0, 100);
+  m.async_set(1, 1);
+  m.sync();
+  hpmr::DenseDistMap<int, int> m2(-10, 10);
+  m2 = m;
+  m.async_set(2, 2);
+  m.sync();
+  m2.async_set(3, 3);
+  m2.sync();
+  EXPECT_EQ(m2.get_key_hi(), 100);
+  EXPECT_EQ(m2.get_n_keys(), 2);
+  EXPECT_EQ(m2.get(1), 1);
+  EXPECT_EQ(m2.get(2, -1), -1);
+  EXPECT_EQ(m.get(3, -1), -1);
+}
+
+TEST(DenseDistMapTest, LargeParallelReduce) {
+  constexpr long long N_KEYS = 1000000;
+  hpmr::DenseDistMap<long long, long long> m(0, N_KEYS);
+#pragma omp parallel for
+  for (long long i = 0; i < N_KEYS * 2; i++) {
+    m.async_set(i % N_KEYS, i, hpmr::Reducer<long long>::Sum());
+  }
+  m.sync(hpmr::Reducer<long long>::Sum());
+  EXPECT_EQ(m.get_n_keys(), N_KEYS);
+  int n_procs;
+  MPI_Comm_size(MPI_COMM_WORLD, &n_procs);
+  for (long long i = 0; i < N_KEYS; i += 1000) EXPECT_EQ(m.get(i), (i * 2 + N_KEYS) * n_procs);
+  const auto& is_even = [](const long long key, const long long) { return key % 2 == 0; };
+  EXPECT_EQ(m.erase_if(is_even), N_KEYS / 2);
+  EXPECT_EQ(m.get_n_keys(), N_KEYS / 2);
+  EXPECT_EQ(m.get(2, -1), -1);
+  m.clear();
+  EXPECT_EQ(m.get_n_keys(), 0);
+}
+
+TEST(DenseDistMapTest, MapReduce) {
+  constexpr int N_KEYS = 100000;
+  hpmr::DenseDistMap<int, int> m(0, N_KEYS);
+#pragma omp parallel for
+  for (int i = 0; i < N_KEYS; i++) m.async_set(i, i);
+  m.sync();
+  const auto& mapper = [](const int key,
+                          const int value,
+                          const std::function<void(const std::string&, const int&)>& emit) {
+    emit(std::to_string(key % 10), value % 2);
+  };
+  auto res = m.mapreduce<std::string, int>(mapper, hpmr::Reducer<int>::sum);
+  EXPECT_EQ(res.get_n_keys(), 10);
+  EXPECT_EQ(res.get("3"), N_KEYS / 10);
+  EXPECT_EQ(res.get("4"), 0);
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <mpi.h>
+#include <cstdlib>
+#include <ctime>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "mpi_type.h"
+
+namespace hpmr {
+// Returns the process ids in an order shuffled on process 0. The distributed containers sync in
+// rounds along this order, which spreads the traffic over the network. Collective.
+inline std::vector<int> generate_shuffled_procs(const int n_procs, const int proc_id) {
+  std::vector<int> res(n_procs);
+
+  if (proc_id == 0) {
+    // Fisher–Yates shuffle algorithm.
+    for (int i = 0; i < n_procs; i++) res[i] = i;
+    srand(time(0));
+    for (int i = res.size() - 1; i > 0; i--) {
+      const int j = rand() % (i + 1);
+      if (i != j) {
+        const int tmp = res[i];
+        res[i] = res[j];
+        res[j] = tmp;
+      }
+    }
+  }
+
+  MPI_Bcast(res.data(), n_procs, MPI_INT, 0, MPI_COMM_WORLD);
+
+  return res;
+}
+
+inline int get_shuffled_id(const std::vector<int>& shuffled_procs, const int proc_id) {
+  const int n_procs = shuffled_procs.size();
+  for (int i = 0; i < n_procs; i++) {
+    if (shuffled_procs[i] == proc_id) return i;
+  }
+  throw std::runtime_error("proc id does not exist in shuffled procs.");
+}
+
+// Sends send_buf to dest_proc_id while receiving recv_buf from src_proc_id, trunk_size bytes at a
+// time.
+inline void exchange_string(
+    const std::string& send_buf,
+    const int dest_proc_id,
+    std::string& recv_buf,
+    const int src_proc_id,
+    const int trunk_size) {
+  char send_buf_char[trunk_size];
+  char recv_buf_char[trunk_size];
+  MPI_Request reqs[2];
+  MPI_Status stats[2];
+  size_t send_cnt = send_buf.size();
+  size_t recv_cnt;
+  MPI_Irecv(&recv_cnt, 1, MpiType<size_t>::value, src_proc_id, 0, MPI_COMM_WORLD, &reqs[0]);
+  MPI_Isend(&send_cnt, 1, MpiType<size_t>::value, dest_proc_id, 0, MPI_COMM_WORLD, &reqs[1]);
+  MPI_Waitall(2, reqs, stats);
+  size_t send_pos = 0;
+  size_t recv_pos = 0;
+  recv_buf.clear();
+  recv_buf.reserve(recv_cnt);
+  const size_t trunk_size_u = static_cast<size_t>(trunk_size);
+  while (send_pos < send_cnt || recv_pos < recv_cnt) {
+    const int recv_trunk_cnt =
+        (recv_cnt - recv_pos >= trunk_size_u) ? trunk_size : recv_cnt - recv_pos;
+    const int send_trunk_cnt =
+        (send_cnt - send_pos >= trunk_size_u) ? trunk_size : send_cnt - send_pos;
+    if (recv_trunk_cnt > 0) {
+      MPI_Irecv(recv_buf_char, recv_trunk_cnt, MPI_CHAR, src_proc_id, 1, MPI_COMM_WORLD, &reqs[0]);
+      recv_pos += recv_trunk_cnt;
+    }
+    if (send_trunk_cnt > 0) {
+      send_buf.copy(send_buf_char, send_trunk_cnt, send_pos);
+      MPI_Issend(
+          send_buf_char, send_trunk_cnt, MPI_CHAR, dest_proc_id, 1, MPI_COMM_WORLD, &reqs[1]);
+      send_pos += send_trunk_cnt;
+    }
+    MPI_Waitall(2, reqs, stats);
+    recv_buf.append(recv_buf_char, recv_trunk_cnt);
+  }
+}
+}  // namespace hpmr
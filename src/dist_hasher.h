@@ -1,6 +1,7 @@
 #pragma once
 
 #include <functional>
+#include "hash_entry.h"
 
 namespace hpmr {
 template <class K, class H>
@@ -14,9 +15,19 @@ class DistHasher {
 
   size_t operator()(const K& key) const { return hasher(key) / n_procs_u; }
 
+  template <class KL, class = EnableIfLookupKey<K, KL, H>>
+  size_t operator()(const KL& key) const { return hasher(key) / n_procs_u; }
+
  private:
   H hasher;
 
   size_t n_procs_u;
 };
+
+template <class K, class H>
+struct IsTransparent<DistHasher<K, H>> : IsTransparent<H> {};
+
+// DistMap computes every hash value it passes with the dist hasher.
+template <class K, class H>
+struct HashValuesComputed<DistHasher<K, H>> : std::true_type {};
 }  // namespace hpmr
@@ -1,17 +1,22 @@
 #pragma once
 
 #include <mpi.h>
-#include <cstdlib>
-#include <ctime>
 #include <functional>
 #include "bare_concurrent_map.h"
+#include "dist_exchange.h"
 #include "dist_hasher.h"
 #include "mpi_type.h"
 #include "reducer.h"
 
 namespace hpmr {
 
-template <class K, class V, class H = std::hash<K>>
+template <
+    class K,
+    class V,
+    class H = Hash<K>,
+    class P = PrimeBucketPolicy,
+    class A = std::allocator<char>,
+    class CA = A>
 class DistMap {
  public:
   DistMap();
@@ -28,24 +33,56 @@ class DistMap {
 
   void set_max_load_factor(const float max_load_factor);
 
-  void async_set(
-      const K& key,
-      const V& value,
-      const std::function<void(V&, const V&)>& reducer = Reducer<V>::overwrite);
+  // Filters lookups of absent keys on the local map, see BareConcurrentMap::set_bloom_filter.
+  void set_bloom_filter(const bool enabled) { local_map.set_bloom_filter(enabled); }
 
+  // Reads the local map without locks, see BareConcurrentMap::set_optimistic_reads.
+  void set_optimistic_reads(const bool enabled) { local_map.set_optimistic_reads(enabled); }
+
+  // Caps the memory of the entries async_set caches per thread on this process, shared evenly by
+  // the local map and the maps buffering entries for other processes. See
+  // BareConcurrentMap::set_thread_cache_budget.
+  void set_thread_cache_budget(const size_t n_bytes);
+
+  // Batches async_set per segment on the local map and the maps buffering entries for other
+  // processes, see BareConcurrentMap::set_write_combining.
+  void set_write_combining(const size_t n_buffer_keys);
+
+  // Reducers are taken by type like BareMap::set.
+  template <class R = typename Reducer<V>::Overwrite>
+  void async_set(const K& key, const V& value, const R& reducer = R()) {
+    async_set_entry(key, value, reducer);
+  }
+
+  // Moves the key and the value in if the key is new.
+  template <class R = typename Reducer<V>::Overwrite>
+  void async_set(K&& key, V&& value, const R& reducer = R()) {
+    async_set_entry(std::move(key), std::move(value), reducer);
+  }
+
+  template <class R = typename Reducer<V>::Keep>
   void sync(
-      const std::function<void(V&, const V&)>& reducer = Reducer<V>::keep,
+      const R& reducer = R(),
       const bool verbose = false,
       const int trunk_size = DEFAULT_TRUNK_SIZE);
 
-  V get(const K& key, const V& default_value = V());
+  V get(const K& key, const V& default_value = V()) { return get<K>(key, default_value); }
+
+  // Takes keys of other types when the hasher is transparent.
+  template <class KL, class = EnableIfLookupKey<K, KL, H>>
+  V get(const KL& key, const V& default_value = V());
+
+  // Removes the entries for which predicate(const K& key, const V& value) is true on every process
+  // and returns the total number removed. Collective, and entries not yet synced are not visited.
+  template <class F>
+  size_t erase_if(const F& predicate);
 
   void clear();
 
   void clear_and_shrink();
 
-  template <class KR, class VR, class HR = std::hash<KR>>
-  DistMap<KR, VR, HR> mapreduce(
+  template <class KR, class VR, class HR = Hash<KR>>
+  DistMap<KR, VR, HR, P, A, CA> mapreduce(
       const std::function<
           void(const K&, const V&, const std::function<void(const KR&, const VR&)>&)>& mapper,
       const std::function<void(VR&, const VR&)>& reducer,
@@ -60,77 +97,95 @@ class DistMap {
 
   float max_load_factor;
 
-  BareConcurrentMap<K, V, DistHasher<K, H>> local_map;
+  BareConcurrentMap<K, V, DistHasher<K, H>, P, A, CA> local_map;
 
-  std::vector<BareConcurrentMap<K, V, DistHasher<K, H>>> remote_maps;
+  std::vector<BareConcurrentMap<K, V, DistHasher<K, H>, P, CA, CA>> remote_maps;
 
   constexpr static int DEFAULT_TRUNK_SIZE = 1 << 20;
 
-  std::vector<int> generate_shuffled_procs();
-
-  int get_shuffled_id(const std::vector<int>& shuffled_procs);
+  template <class KF, class VF, class R>
+  void async_set_entry(KF&& key, VF&& value, const R& reducer);
 };
 
-template <class K, class V, class H>
-DistMap<K, V, H>::DistMap() {
+template <class K, class V, class H, class P, class A, class CA>
+DistMap<K, V, H, P, A, CA>::DistMap() {
   MPI_Comm_size(MPI_COMM_WORLD, &n_procs);
   MPI_Comm_rank(MPI_COMM_WORLD, &proc_id);
   remote_maps.resize(n_procs);
   max_load_factor = local_map.get_max_load_factor();
 }
 
-template <class K, class V, class H>
-void DistMap<K, V, H>::reserve(const size_t n_keys_min) {
+template <class K, class V, class H, class P, class A, class CA>
+void DistMap<K, V, H, P, A, CA>::reserve(const size_t n_keys_min) {
   local_map.reserve(n_keys_min / n_procs);
   for (auto& remote_map : remote_maps) {
     remote_map.reserve(n_keys_min / n_procs / n_procs);
   }
 }
 
-template <class K, class V, class H>
-size_t DistMap<K, V, H>::get_n_keys() {
+template <class K, class V, class H, class P, class A, class CA>
+size_t DistMap<K, V, H, P, A, CA>::get_n_keys() {
   const size_t local_n_keys = local_map.get_n_keys();
   size_t n_keys;
   MPI_Allreduce(&local_n_keys, &n_keys, 1, MpiType<size_t>::value, MPI_SUM, MPI_COMM_WORLD);
   return n_keys;
 }
 
-template <class K, class V, class H>
-size_t DistMap<K, V, H>::get_n_buckets() {
+template <class K, class V, class H, class P, class A, class CA>
+size_t DistMap<K, V, H, P, A, CA>::get_n_buckets() {
   const size_t local_n_buckets = local_map.get_n_buckets();
   size_t n_buckets;
   MPI_Allreduce(&local_n_buckets, &n_buckets, 1, MpiType<size_t>::value, MPI_SUM, MPI_COMM_WORLD);
   return n_buckets;
 }
 
-template <class K, class V, class H>
-float DistMap<K, V, H>::get_load_factor() {
+template <class K, class V, class H, class P, class A, class CA>
+float DistMap<K, V, H, P, A, CA>::get_load_factor() {
   return static_cast<float>(get_n_buckets()) / get_n_keys();
 }
 
-template <class K, class V, class H>
-void DistMap<K, V, H>::set_max_load_factor(const float max_load_factor) {
+template <class K, class V, class H, class P, class A, class CA>
+void DistMap<K, V, H, P, A, CA>::set_max_load_factor(const float max_load_factor) {
   this->max_load_factor = max_load_factor;
   local_map.set_max_load_factor(max_load_factor);
   for (auto& remote_map : remote_maps) remote_map.set_max_load_factor(max_load_factor);
 }
 
-template <class K, class V, class H>
-void DistMap<K, V, H>::async_set(
-    const K& key, const V& value, const std::function<void(V&, const V&)>& reducer) {
+template <class K, class V, class H, class P, class A, class CA>
+void DistMap<K, V, H, P, A, CA>::set_thread_cache_budget(const size_t n_bytes) {
+  const size_t n_map_bytes = n_bytes / n_procs;
+  local_map.set_thread_cache_budget(n_map_bytes);
+  for (int i = 0; i < n_procs; i++) {
+    if (i != proc_id) remote_maps[i].set_thread_cache_budget(n_map_bytes);
+  }
+}
+
+template <class K, class V, class H, class P, class A, class CA>
+void DistMap<K, V, H, P, A, CA>::set_write_combining(const size_t n_buffer_keys) {
+  local_map.set_write_combining(n_buffer_keys);
+  for (int i = 0; i < n_procs; i++) {
+    if (i != proc_id) remote_maps[i].set_write_combining(n_buffer_keys);
+  }
+}
+
+template <class K, class V, class H, class P, class A, class CA>
+template <class KF, class VF, class R>
+void DistMap<K, V, H, P, A, CA>::async_set_entry(KF&& key, VF&& value, const R& reducer) {
   const size_t hash_value = hasher(key);
   const size_t n_procs_u = static_cast<size_t>(n_procs);
   const size_t dest_proc_id = hash_value % n_procs_u;
   const size_t dist_hash_value = hash_value / n_procs_u;
   if (dest_proc_id == static_cast<size_t>(proc_id)) {
-    local_map.async_set(key, dist_hash_value, value, reducer);
+    local_map.async_set(std::forward<KF>(key), dist_hash_value, std::forward<VF>(value), reducer);
   } else {
-    remote_maps[dest_proc_id].async_set(key, dist_hash_value, value, reducer);
+    remote_maps[dest_proc_id].async_set(
+        std::forward<KF>(key), dist_hash_value, std::forward<VF>(value), reducer);
   }
 }
 
-template <class K, class V, class H>
-V DistMap<K, V, H>::get(const K& key, const V& default_value) {
+template <class K, class V, class H, class P, class A, class CA>
+template <class KL, class>
+V DistMap<K, V, H, P, A, CA>::get(const KL& key, const V& default_value) {
   // TODO: support non numerical V with type traits specialization.
   const size_t hash_value = hasher(key);
   const size_t n_procs_u = static_cast<size_t>(n_procs);
@@ -144,122 +199,63 @@ V DistMap<K, V, H>::get(const K& key, const V& default_value) {
   return res;
 }
 
-template <class K, class V, class H>
-void DistMap<K, V, H>::sync(
-    const std::function<void(V&, const V&)>& reducer, const bool verbose, const int trunk_size) {
+template <class K, class V, class H, class P, class A, class CA>
+template <class R>
+void DistMap<K, V, H, P, A, CA>::sync(const R& reducer, const bool verbose, const int trunk_size) {
   assert(trunk_size > 0);
   const bool report = proc_id == 0 && verbose;
   if (report) printf("Syncing: ");
 
-  const auto& node_handler = [&](const K& key, const size_t hash_value, const V& value) {
-    local_map.async_set(key, hash_value, value, reducer);
-  };
-
   // Accelerate overall network transfer through randomization.
-  const auto& shuffled_procs = generate_shuffled_procs();
-  const int shuffled_id = get_shuffled_id(shuffled_procs);
+  const auto& shuffled_procs = generate_shuffled_procs(n_procs, proc_id);
+  const int shuffled_id = get_shuffled_id(shuffled_procs, proc_id);
 
   std::string send_buf;
   std::string recv_buf;
-  char send_buf_char[trunk_size];
-  char recv_buf_char[trunk_size];
-  MPI_Request reqs[2];
-  MPI_Status stats[2];
   for (int i = 1; i < n_procs; i++) {
     const int dest_proc_id = shuffled_procs[(shuffled_id + i) % n_procs];
     const int src_proc_id = shuffled_procs[(shuffled_id + n_procs - i) % n_procs];
     remote_maps[dest_proc_id].sync(reducer);
     send_buf = remote_maps[dest_proc_id].to_string();
     remote_maps[dest_proc_id].clear();
-    size_t send_cnt = send_buf.size();
-    size_t recv_cnt;
-    MPI_Irecv(&recv_cnt, 1, MpiType<size_t>::value, src_proc_id, 0, MPI_COMM_WORLD, &reqs[0]);
-    MPI_Isend(&send_cnt, 1, MpiType<size_t>::value, dest_proc_id, 0, MPI_COMM_WORLD, &reqs[1]);
-    MPI_Waitall(2, reqs, stats);
-    size_t send_pos = 0;
-    size_t recv_pos = 0;
-    recv_buf.clear();
-    recv_buf.reserve(recv_cnt);
-    const size_t trunk_size_u = static_cast<size_t>(trunk_size);
-    while (send_pos < send_cnt || recv_pos < recv_cnt) {
-      const int recv_trunk_cnt =
-          (recv_cnt - recv_pos >= trunk_size_u) ? trunk_size : recv_cnt - recv_pos;
-      const int send_trunk_cnt =
-          (send_cnt - send_pos >= trunk_size_u) ? trunk_size : send_cnt - send_pos;
-      if (recv_trunk_cnt > 0) {
-        MPI_Irecv(
-            recv_buf_char, recv_trunk_cnt, MPI_CHAR, src_proc_id, 1, MPI_COMM_WORLD, &reqs[0]);
-        recv_pos += recv_trunk_cnt;
-      }
-      if (send_trunk_cnt > 0) {
-        send_buf.copy(send_buf_char, send_trunk_cnt, send_pos);
-        MPI_Issend(
-            send_buf_char, send_trunk_cnt, MPI_CHAR, dest_proc_id, 1, MPI_COMM_WORLD, &reqs[1]);
-        send_pos += send_trunk_cnt;
-      }
-      MPI_Waitall(2, reqs, stats);
-      recv_buf.append(recv_buf_char, recv_trunk_cnt);
-    }
+    exchange_string(send_buf, dest_proc_id, recv_buf, src_proc_id, trunk_size);
     remote_maps[dest_proc_id].from_string(recv_buf);
-    remote_maps[dest_proc_id].for_each(node_handler);
-    remote_maps[dest_proc_id].clear();
+    local_map.merge_from(std::move(remote_maps[dest_proc_id]), reducer);
     if (report) printf("%d/%d ", i - 1, n_procs - 1);
   }
   local_map.sync(reducer);
   if (report) printf("#\n");
 }
 
-template <class K, class V, class H>
-std::vector<int> DistMap<K, V, H>::generate_shuffled_procs() {
-  std::vector<int> res(n_procs);
-
-  if (proc_id == 0) {
-    // Fisher–Yates shuffle algorithm.
-    for (int i = 0; i < n_procs; i++) res[i] = i;
-    srand(time(0));
-    for (int i = res.size() - 1; i > 0; i--) {
-      const int j = rand() % (i + 1);
-      if (i != j) {
-        const int tmp = res[i];
-        res[i] = res[j];
-        res[j] = tmp;
-      }
-    }
-  }
-
-  MPI_Bcast(res.data(), n_procs, MPI_INT, 0, MPI_COMM_WORLD);
-
-  return res;
-}
-
-template <class K, class V, class H>
-int DistMap<K, V, H>::get_shuffled_id(const std::vector<int>& shuffled_procs) {
-  for (int i = 0; i < n_procs; i++) {
-    if (shuffled_procs[i] == proc_id) return i;
-  }
-  throw std::runtime_error("proc id does not exist in shuffled procs.");
+template <class K, class V, class H, class P, class A, class CA>
+template <class F>
+size_t DistMap<K, V, H, P, A, CA>::erase_if(const F& predicate) {
+  const size_t local_n_erased = local_map.erase_if(predicate);
+  size_t n_erased;
+  MPI_Allreduce(&local_n_erased, &n_erased, 1, MpiType<size_t>::value, MPI_SUM, MPI_COMM_WORLD);
+  return n_erased;
 }
 
-template <class K, class V, class H>
-void DistMap<K, V, H>::clear() {
+template <class K, class V, class H, class P, class A, class CA>
+void DistMap<K, V, H, P, A, CA>::clear() {
   local_map.clear();
   for (auto& remote_map : remote_maps) remote_map.clear();
 }
 
-template <class K, class V, class H>
-void DistMap<K, V, H>::clear_and_shrink() {
+template <class K, class V, class H, class P, class A, class CA>
+void DistMap<K, V, H, P, A, CA>::clear_and_shrink() {
   local_map.clear_and_shrink();
   for (auto& remote_map : remote_maps) remote_map.clear_and_shrink();
 }
 
-template <class K, class V, class H>
+template <class K, class V, class H, class P, class A, class CA>
 template <class KR, class VR, class HR>
-DistMap<KR, VR, HR> DistMap<K, V, H>::mapreduce(
+DistMap<KR, VR, HR, P, A, CA> DistMap<K, V, H, P, A, CA>::mapreduce(
     const std::function<void(const K&, const V&, const std::function<void(const KR&, const VR&)>&)>&
         mapper,
     const std::function<void(VR&, const VR&)>& reducer,
     const bool verbose) {
-  DistMap<KR, VR, HR> res;
+  DistMap<KR, VR, HR, P, A, CA> res;
 
   const bool report = verbose && proc_id == 0;
   if (report) {
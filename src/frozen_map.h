@@ -0,0 +1,28 @@
+#pragma once
+
+#include "bare_frozen_map.h"
+
+namespace hpmr {
+// An immutable map that hashes the keys itself, from ConcurrentMap::freeze.
+template <class K, class V, class H = Hash<K>, class A = std::allocator<char>>
+class FrozenMap : public BareFrozenMap<K, V, H, A> {
+ public:
+  V get(const K& key, const V& default_value = V()) const {
+    return BareFrozenMap<K, V, H, A>::get(key, hasher(key), default_value);
+  }
+
+  // Takes keys of other types when the hasher is transparent.
+  template <class KL, class = EnableIfLookupKey<K, KL, H>>
+  V get(const KL& key, const V& default_value = V()) const {
+    return BareFrozenMap<K, V, H, A>::get(key, hasher(key), default_value);
+  }
+
+  bool has(const K& key) const { return BareFrozenMap<K, V, H, A>::has(key, hasher(key)); }
+
+  template <class KL, class = EnableIfLookupKey<K, KL, H>>
+  bool has(const KL& key) const { return BareFrozenMap<K, V, H, A>::has(key, hasher(key)); }
+
+ private:
+  H hasher;
+};
+}  // namespace hpmr
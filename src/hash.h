@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <type_traits>
+#include <vector>
+#if __cplusplus >= 201703L
+#include <string_view>
+#endif
+
+namespace hpmr {
+// Finalizer of MurmurHash3. A bijection on 64 bit values in which every input bit affects every
+// output bit, so keys that only differ in a few bits still spread over the buckets.
+inline size_t mix_hash(const size_t hash_value) {
+  uint64_t x = hash_value;
+  x ^= x >> 33;
+  x *= 0xFF51AFD7ED558CCDULL;
+  x ^= x >> 33;
+  x *= 0xC4CEB9FE1A85EC53ULL;
+  x ^= x >> 33;
+  return static_cast<size_t>(x);
+}
+
+// Maps a hash value to one of n_segments segments of a concurrent container. Takes the high bits
+// of the mixed hash value, so any number of segments works. The bucket policies never see the mixed
+// value, so the keys of one segment still spread over all of its buckets, and bloom filters and
+// frozen map groups read it from the low bits up.
+inline size_t get_segment_id(const size_t hash_value, const size_t n_segments) {
+  const uint64_t spread = mix_hash(hash_value);
+  return static_cast<size_t>((static_cast<unsigned __int128>(spread) * n_segments) >> 64);
+}
+
+// Hashes size bytes, mixing in 8 bytes at a time.
+inline size_t hash_bytes(const void* data, const size_t size) {
+  constexpr uint64_t MULTIPLIER = 0x9E3779B97F4A7C15ULL;
+  const char* bytes = static_cast<const char*>(data);
+  uint64_t hash = size * MULTIPLIER;
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    uint64_t word;
+    memcpy(&word, bytes + i, 8);
+    hash = (hash ^ word) * MULTIPLIER;
+    hash ^= hash >> 32;
+  }
+  uint64_t tail = 0;
+  if (i < size) memcpy(&tail, bytes + i, size - i);
+  return mix_hash(static_cast<size_t>(hash ^ tail));
+}
+
+// The default hasher of the containers. Integers are mixed so that sequential or strided keys do
+// not cluster, strings and vectors of integers are hashed as byte spans, and other types mix the
+// result of std::hash.
+template <class K, class = void>
+class Hash {
+ public:
+  size_t operator()(const K& key) const { return mix_hash(std::hash<K>()(key)); }
+};
+
+template <class K>
+class Hash<K, typename std::enable_if<std::is_integral<K>::value>::type> {
+ public:
+  size_t operator()(const K key) const { return mix_hash(static_cast<size_t>(key)); }
+};
+
+// Transparent, so C strings (and std::string_view under C++17) are looked up without constructing
+// a std::string.
+template <>
+class Hash<std::string> {
+ public:
+  typedef void is_transparent;
+
+  size_t operator()(const std::string& key) const { return hash_bytes(key.data(), key.size()); }
+
+  size_t operator()(const char* key) const { return hash_bytes(key, strlen(key)); }
+
+#if __cplusplus >= 201703L
+  size_t operator()(const std::string_view key) const { return hash_bytes(key.data(), key.size()); }
+#endif
+};
+
+template <class T>
+class Hash<
+    std::vector<T>,
+    typename std::enable_if<std::is_integral<T>::value && !std::is_same<T, bool>::value>::type> {
+ public:
+  size_t operator()(const std::vector<T>& key) const {
+    return hash_bytes(key.data(), key.size() * sizeof(T));
+  }
+};
+
+typedef Hash<std::string> StringHash;
+}  // namespace hpmr
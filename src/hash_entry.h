@@ -1,44 +1,115 @@
 #pragma once
 
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+
 namespace hpmr {
-template <class K, class V>
-class HashEntry {
+// Whether every hash value passed to containers with hasher H is computed with H, which holds for
+// the hasher of wrappers that hash the keys themselves, see ComputedHash.
+template <class H>
+struct HashValuesComputed : std::false_type {};
+
+// Marks H as the hasher of a wrapper that computes every hash value it passes with H, such as
+// ConcurrentMap and HashSet.
+template <class H>
+class ComputedHash : public H {};
+
+template <class H>
+struct HashValuesComputed<ComputedHash<H>> : std::true_type {};
+
+// Whether hash entries store the hash value of their keys. Entries of keys that are cheap to hash
+// drop it when the hash values are computed with the hasher, and recompute it when needed, which
+// saves 8 bytes per entry in memory and when serialized. Other entries keep it, so callers of the
+// bare containers may pass any hash value. Specialize to choose explicitly.
+template <class K, class H>
+struct StoreHashValue
+    : std::integral_constant<bool, !std::is_arithmetic<K>::value || !HashValuesComputed<H>::value> {
+};
+
+template <class T>
+struct VoidType {
+  typedef void type;
+};
+
+// Whether the hasher H declares is_transparent. If so, the containers also look up keys of other
+// types that H hashes the same as the equal keys and that compare with the keys by operator==, so
+// callers need not construct a key for each lookup.
+template <class H, class = void>
+struct IsTransparent : std::false_type {};
+
+template <class H>
+struct IsTransparent<H, typename VoidType<typename H::is_transparent>::type> : std::true_type {};
+
+// Enables the lookup overloads for keys of type KL, which is either K or any type if H is
+// transparent.
+template <class K, class KL, class H>
+using EnableIfLookupKey =
+    typename std::enable_if<std::is_same<K, KL>::value || IsTransparent<H>::value>::type;
+
+// The key of a hash entry, with its hash value if stored.
+template <class K, bool STORE_HASH_VALUE = true>
+class HashKey {
  public:
   K key;
 
   size_t hash_value;
 
-  V value;
-
-  bool filled;
+  template <class H>
+  size_t get_hash_value(const H&) const {
+    return hash_value;
+  }
 
-  HashEntry() : filled(false){};
+  template <class KL>
+  bool has_key(const KL& key, const size_t hash_value) const {
+    return this->hash_value == hash_value && this->key == key;
+  }
 
-  void fill(const K& key, const size_t hash_value, const V& value) {
-    this->key = key;
+  template <class KF>
+  void set_key(KF&& key, const size_t hash_value) {
+    this->key = std::forward<KF>(key);
     this->hash_value = hash_value;
-    this->value = value;
-    filled = true;
   }
 };
 
-// For hash set.
 template <class K>
-class HashEntry<K, void> {
+class HashKey<K, false> {
  public:
   K key;
 
-  size_t hash_value;
+  template <class H>
+  size_t get_hash_value(const H& hasher) const {
+    return hasher(key);
+  }
 
-  bool filled;
+  template <class KL>
+  bool has_key(const KL& key, const size_t) const { return this->key == key; }
 
-  HashEntry() : filled(false){};
+  template <class KF>
+  void set_key(KF&& key, const size_t) { this->key = std::forward<KF>(key); }
+};
 
-  void fill(const K& key, const size_t hash_value) {
-    this->key = key;
-    this->hash_value = hash_value;
-    filled = true;
+// Whether a bucket is filled is kept in the control bytes of the container, so entries have no
+// padding for a flag.
+template <class K, class V, class H>
+class HashEntry : public HashKey<K, StoreHashValue<K, H>::value> {
+ public:
+  V value;
+
+  // Copies or moves the key and the value in depending on their value categories.
+  template <class KF, class VF>
+  void fill(KF&& key, const size_t hash_value, VF&& value) {
+    this->set_key(std::forward<KF>(key), hash_value);
+    this->value = std::forward<VF>(value);
   }
 };
 
+// For hash set.
+template <class K, class H>
+class HashEntry<K, void, H> : public HashKey<K, StoreHashValue<K, H>::value> {
+ public:
+  template <class KF>
+  void fill(KF&& key, const size_t hash_value) { this->set_key(std::forward<KF>(key), hash_value); }
+};
+
 }  // namespace hpmr
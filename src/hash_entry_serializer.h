@@ -4,43 +4,51 @@
 #include "hash_entry.h"
 
 namespace hps {
-template <class K, class V, class B>
-class Serializer<hpmr::HashEntry<K, V>, B> {
+template <class K, class B>
+class Serializer<hpmr::HashKey<K, true>, B> {
  public:
-  static void serialize(const hpmr::HashEntry<K, V>& entry, OutputBuffer<B>& ob) {
-    Serializer<bool, B>::serialize(entry.filled, ob);
-    if (entry.filled) {
-      Serializer<K, B>::serialize(entry.key, ob);
-      Serializer<size_t, B>::serialize(entry.hash_value, ob);
-      Serializer<V, B>::serialize(entry.value, ob);
-    }
-  }
-  static void parse(hpmr::HashEntry<K, V>& entry, InputBuffer<B>& ib) {
-    Serializer<bool, B>::parse(entry.filled, ib);
-    if (entry.filled) {
-      Serializer<K, B>::parse(entry.key, ib);
-      Serializer<size_t, B>::parse(entry.hash_value, ib);
-      Serializer<V, B>::parse(entry.value, ib);
-    }
+  static void serialize(const hpmr::HashKey<K, true>& hash_key, OutputBuffer<B>& ob) {
+    Serializer<K, B>::serialize(hash_key.key, ob);
+    Serializer<size_t, B>::serialize(hash_key.hash_value, ob);
+  }
+  static void parse(hpmr::HashKey<K, true>& hash_key, InputBuffer<B>& ib) {
+    Serializer<K, B>::parse(hash_key.key, ib);
+    Serializer<size_t, B>::parse(hash_key.hash_value, ib);
   }
 };
 
 template <class K, class B>
-class Serializer<hpmr::HashEntry<K, void>, B> {
+class Serializer<hpmr::HashKey<K, false>, B> {
+ public:
+  static void serialize(const hpmr::HashKey<K, false>& hash_key, OutputBuffer<B>& ob) {
+    Serializer<K, B>::serialize(hash_key.key, ob);
+  }
+  static void parse(hpmr::HashKey<K, false>& hash_key, InputBuffer<B>& ib) {
+    Serializer<K, B>::parse(hash_key.key, ib);
+  }
+};
+
+template <class K, class V, class H, class B>
+class Serializer<hpmr::HashEntry<K, V, H>, B> {
  public:
-  static void serialize(const hpmr::HashEntry<K, void>& entry, OutputBuffer<B>& ob) {
-    Serializer<bool, B>::serialize(entry.filled, ob);
-    if (entry.filled) {
-      Serializer<K, B>::serialize(entry.key, ob);
-      Serializer<size_t, B>::serialize(entry.hash_value, ob);
-    }
-  }
-  static void parse(hpmr::HashEntry<K, void>& entry, InputBuffer<B>& ib) {
-    Serializer<bool, B>::parse(entry.filled, ib);
-    if (entry.filled) {
-      Serializer<K, B>::parse(entry.key, ib);
-      Serializer<size_t, B>::parse(entry.hash_value, ib);
-    }
+  static void serialize(const hpmr::HashEntry<K, V, H>& entry, OutputBuffer<B>& ob) {
+    Serializer<hpmr::HashKey<K, hpmr::StoreHashValue<K, H>::value>, B>::serialize(entry, ob);
+    Serializer<V, B>::serialize(entry.value, ob);
+  }
+  static void parse(hpmr::HashEntry<K, V, H>& entry, InputBuffer<B>& ib) {
+    Serializer<hpmr::HashKey<K, hpmr::StoreHashValue<K, H>::value>, B>::parse(entry, ib);
+    Serializer<V, B>::parse(entry.value, ib);
+  }
+};
+
+template <class K, class H, class B>
+class Serializer<hpmr::HashEntry<K, void, H>, B> {
+ public:
+  static void serialize(const hpmr::HashEntry<K, void, H>& entry, OutputBuffer<B>& ob) {
+    Serializer<hpmr::HashKey<K, hpmr::StoreHashValue<K, H>::value>, B>::serialize(entry, ob);
+  }
+  static void parse(hpmr::HashEntry<K, void, H>& entry, InputBuffer<B>& ib) {
+    Serializer<hpmr::HashKey<K, hpmr::StoreHashValue<K, H>::value>, B>::parse(entry, ib);
   }
 };
 }  // namespace hps
@@ -4,27 +4,38 @@
 
 // Linear probing hash set for better parallel performance.
 namespace hpmr {
-template <class K, class H = std::hash<K>>
-class HashSet : public BareSet<K, H> {
+template <
+    class K,
+    class H = Hash<K>,
+    class P = PrimeBucketPolicy,
+    class A = std::allocator<char>>
+class HashSet : public BareSet<K, ComputedHash<H>, P, A> {
  public:
-  void set(const K& key) { BareSet<K, H>::set(key, hasher(key)); }
+  void set(const K& key) { BareSet<K, ComputedHash<H>, P, A>::set(key, hasher(key)); }
 
-  void unset(const K& key) { BareSet<K, H>::unset(key, hasher(key)); }
+  void unset(const K& key) { BareSet<K, ComputedHash<H>, P, A>::unset(key, hasher(key)); }
 
-  bool has(const K& key) { return BareSet<K, H>::has(key, hasher(key)); }
+  // Takes keys of other types when the hasher is transparent.
+  template <class KL, class = EnableIfLookupKey<K, KL, H>>
+  void unset(const KL& key) { BareSet<K, ComputedHash<H>, P, A>::unset(key, hasher(key)); }
 
- private:
-  H hasher;
+  bool has(const K& key) { return BareSet<K, ComputedHash<H>, P, A>::has(key, hasher(key)); }
+
+  template <class KL, class = EnableIfLookupKey<K, KL, H>>
+  bool has(const KL& key) { return BareSet<K, ComputedHash<H>, P, A>::has(key, hasher(key)); }
+
+ protected:
+  using BareSet<K, ComputedHash<H>, P, A>::hasher;
 };
 }  // namespace hpmr
 
 namespace hps {
-template <class K, class H, class B>
-class Serializer<hpmr::HashSet<K, H>, B> {
+template <class K, class H, class P, class A, class B>
+class Serializer<hpmr::HashSet<K, H, P, A>, B> {
  public:
-  static void serialize(const hpmr::HashSet<K, H>& set, OutputBuffer<B>& buf) {
+  static void serialize(const hpmr::HashSet<K, H, P, A>& set, OutputBuffer<B>& buf) {
     set.serialize(buf);
   }
-  static void parse(hpmr::HashSet<K, H>& set, InputBuffer<B>& buf) { set.parse(buf); }
+  static void parse(hpmr::HashSet<K, H, P, A>& set, InputBuffer<B>& buf) { set.parse(buf); }
 };
 }  // namespace hps
@@ -3,6 +3,7 @@
 #include <gtest/gtest.h>
 #include <unordered_set>
 #include "reducer.h"
+#include "hash.h"
 
 TEST(HashSetTest, Initialization) {
   hpmr::HashSet<std::string> m;
@@ -80,8 +81,10 @@ TEST(HashSetTest, LargeAutoRehashSetAndHasSTLComparison) {
 TEST(HashSetTest, LargeAutoRehashSetAndHas) {
   hpmr::HashSet<int> m;
   constexpr int N_KEYS = 1000000;
-  for (int i = 0; i < N_KEYS; i++) m.set(i * i);
-  for (int i = 0; i < N_KEYS; i += 10) EXPECT_TRUE(m.has(i * i));
+  // Squares wrap around in unsigned arithmetic, since signed overflow is undefined.
+  const auto& square = [](const int i) { return static_cast<int>(static_cast<unsigned>(i) * i); };
+  for (int i = 0; i < N_KEYS; i++) m.set(square(i));
+  for (int i = 0; i < N_KEYS; i += 10) EXPECT_TRUE(m.has(square(i)));
 }
 
 TEST(HashSetTest, UnsetAndHas) {
@@ -154,3 +157,17 @@ TEST(HashSetTest, ToAndFromString) {
   EXPECT_TRUE(m2.has("aa"));
   EXPECT_TRUE(m2.has("bbb"));
 }
+
+TEST(HashSetTest, TransparentLookup) {
+  hpmr::HashSet<std::string, hpmr::StringHash> m;
+  constexpr int N_KEYS = 1000;
+  for (int i = 0; i < N_KEYS; i++) m.set(std::to_string(i));
+  char key[16];
+  for (int i = 0; i < N_KEYS * 2; i++) {
+    snprintf(key, sizeof(key), "%d", i);
+    EXPECT_EQ(m.has(static_cast<const char*>(key)), i < N_KEYS);
+  }
+  m.unset("7");
+  EXPECT_FALSE(m.has("7"));
+  EXPECT_EQ(m.get_n_keys(), N_KEYS - 1);
+}
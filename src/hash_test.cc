@@ -0,0 +1,59 @@
+#include "hash.h"
+
+#include <gtest/gtest.h>
+#include <string>
+#include <unordered_set>
+#include <vector>
+#include "bare_map.h"
+#include "bucket_policy.h"
+
+TEST(HashTest, MixesIntegers) {
+  hpmr::Hash<int> hasher;
+  std::unordered_set<size_t> top_bytes;
+  for (int i = 0; i < 1000; i++) {
+    EXPECT_EQ(hasher(i), hpmr::mix_hash(i));
+    top_bytes.insert(hasher(i) >> 56);
+  }
+  // Sequential keys spread over the high bits too.
+  EXPECT_GT(top_bytes.size(), 200);
+}
+
+TEST(HashTest, StringsAndCStrings) {
+  hpmr::Hash<std::string> hasher;
+  EXPECT_TRUE(hpmr::IsTransparent<hpmr::Hash<std::string>>::value);
+  EXPECT_FALSE(hpmr::IsTransparent<hpmr::Hash<int>>::value);
+  EXPECT_EQ(hasher(std::string("abcdefghijk")), hasher("abcdefghijk"));
+  EXPECT_NE(hasher("abcdefghijk"), hasher("abcdefghijl"));
+  EXPECT_NE(hasher(""), hasher(std::string(1, '\0')));
+}
+
+TEST(HashTest, VectorsOfIntegers) {
+  hpmr::Hash<std::vector<int>> hasher;
+  EXPECT_EQ(hasher({1, 2, 3}), hasher({1, 2, 3}));
+  EXPECT_NE(hasher({1, 2, 3}), hasher({3, 2, 1}));
+  EXPECT_NE(hasher({1, 2}), hasher({1, 2, 0}));
+}
+
+TEST(HashTest, DefaultHasherOfContainers) {
+  hpmr::BareMap<int, int> m;
+  hpmr::Hash<int> hasher;
+  constexpr int N_KEYS = 100000;
+  for (int i = 0; i < N_KEYS; i++) m.set(i * 1024, hasher(i * 1024), i);
+  for (int i = 0; i < N_KEYS; i++) EXPECT_EQ(m.get(i * 1024, hasher(i * 1024)), i);
+}
+
+TEST(HashTest, SegmentsSpreadOverBuckets) {
+  // The buckets one segment of a concurrent container uses for its keys, with hash values that
+  // are not mixed.
+  constexpr size_t N_SEGMENTS = 16;
+  constexpr size_t N_BUCKETS = 1024;
+  std::unordered_set<size_t> bucket_ids;
+  size_t n_segment_keys = 0;
+  for (size_t hash_value = 0; n_segment_keys < N_BUCKETS / 2; hash_value++) {
+    if (hpmr::get_segment_id(hash_value, N_SEGMENTS) != 0) continue;
+    n_segment_keys++;
+    bucket_ids.insert(hpmr::PowerOfTwoBucketPolicy::get_bucket_id(hash_value, N_BUCKETS));
+  }
+  // About 1 - exp(-0.5) of the buckets are occupied if the bits are independent.
+  EXPECT_GT(bucket_ids.size(), N_BUCKETS / 3);
+}
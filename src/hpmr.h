@@ -1,10 +1,17 @@
 #pragma once
 
 // Containers.
+#include "bare_atomic_map.h"
+#include "bare_atomic_set.h"
 #include "concurrent_map.h"
+#include "dense_dist_map.h"
 #include "dist_map.h"
 #include "range.h"
 
 // Utility libraries.
+#include "bloom_filter.h"
+#include "hash.h"
+#include "huge_page_allocator.h"
 #include "mpi_type.h"
+#include "pool_allocator.h"
 #include "reducer.h"
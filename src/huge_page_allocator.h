@@ -0,0 +1,76 @@
+#pragma once
+
+#include <sys/mman.h>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+
+namespace hpmr {
+// Allocates large arrays with mmap aligned to huge pages and asks the kernel to back them with
+// transparent huge pages, so random probes into multi GB bucket arrays miss the TLB less often and
+// filling them takes fewer page faults. Arrays smaller than a huge page use std::allocator.
+template <class T>
+class HugePageAllocator {
+ public:
+  typedef T value_type;
+
+  constexpr static size_t HUGE_PAGE_SIZE = 2 << 20;
+
+  HugePageAllocator() {}
+
+  template <class U>
+  HugePageAllocator(const HugePageAllocator<U>&) {}
+
+  T* allocate(const size_t n);
+
+  void deallocate(T* ptr, const size_t n);
+
+ private:
+  static size_t get_mmap_size(const size_t n) {
+    return (n * sizeof(T) + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+  }
+};
+
+template <class T>
+T* HugePageAllocator<T>::allocate(const size_t n) {
+  if (n * sizeof(T) < HUGE_PAGE_SIZE) return std::allocator<T>().allocate(n);
+  const size_t size = get_mmap_size(n);
+
+  // Map one extra huge page and unmap the ends so the array starts on a huge page boundary.
+  const size_t mapped_size = size + HUGE_PAGE_SIZE;
+  void* mapped =
+      mmap(nullptr, mapped_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mapped == MAP_FAILED) throw std::bad_alloc();
+  const uintptr_t mapped_addr = reinterpret_cast<uintptr_t>(mapped);
+  const uintptr_t addr = (mapped_addr + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+  if (addr > mapped_addr) munmap(mapped, addr - mapped_addr);
+  const size_t tail_size = mapped_addr + HUGE_PAGE_SIZE - addr;
+  if (tail_size > 0) munmap(reinterpret_cast<void*>(addr + size), tail_size);
+
+  void* ptr = reinterpret_cast<void*>(addr);
+#ifdef MADV_HUGEPAGE
+  madvise(ptr, size, MADV_HUGEPAGE);
+#endif
+  return static_cast<T*>(ptr);
+}
+
+template <class T>
+void HugePageAllocator<T>::deallocate(T* ptr, const size_t n) {
+  if (n * sizeof(T) < HUGE_PAGE_SIZE) {
+    std::allocator<T>().deallocate(ptr, n);
+  } else {
+    munmap(ptr, get_mmap_size(n));
+  }
+}
+
+template <class T, class U>
+bool operator==(const HugePageAllocator<T>&, const HugePageAllocator<U>&) {
+  return true;
+}
+
+template <class T, class U>
+bool operator!=(const HugePageAllocator<T>&, const HugePageAllocator<U>&) {
+  return false;
+}
+}  // namespace hpmr
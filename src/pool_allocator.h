@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <vector>
+
+namespace hpmr {
+// Per thread free lists of blocks with power of two sizes.
+class MemoryPool {
+ public:
+  constexpr static size_t MIN_BLOCK_SIZE = 64;
+
+  // Blocks returned while the pool already keeps this many bytes go back to the system, so that an
+  // idle pool holds about the last few generations of a growing table at most.
+  constexpr static size_t MAX_N_POOLED_BYTES = 1 << 27;
+
+  ~MemoryPool() {
+    for (auto& free_blocks : free_lists) {
+      for (void* block : free_blocks) ::operator delete(block);
+    }
+  }
+
+  static MemoryPool& get_thread_pool() {
+    static thread_local MemoryPool pool;
+    return pool;
+  }
+
+  void* allocate(const size_t size) {
+    const int size_class = get_size_class(size);
+    if (size_class < N_SIZE_CLASSES && !free_lists[size_class].empty()) {
+      void* block = free_lists[size_class].back();
+      free_lists[size_class].pop_back();
+      n_pooled_bytes -= MIN_BLOCK_SIZE << size_class;
+      return block;
+    }
+    return ::operator new(get_block_size(size, size_class));
+  }
+
+  void deallocate(void* block, const size_t size) {
+    const int size_class = get_size_class(size);
+    const size_t block_size = get_block_size(size, size_class);
+    if (size_class < N_SIZE_CLASSES && n_pooled_bytes + block_size <= MAX_N_POOLED_BYTES) {
+      free_lists[size_class].push_back(block);
+      n_pooled_bytes += block_size;
+    } else {
+      ::operator delete(block);
+    }
+  }
+
+  // Bytes of the blocks kept for reuse.
+  size_t get_n_pooled_bytes() const { return n_pooled_bytes; }
+
+ private:
+  // Blocks up to 64 MB are pooled. Larger ones go straight back to the system.
+  constexpr static int N_SIZE_CLASSES = 21;
+
+  std::vector<void*> free_lists[N_SIZE_CLASSES];
+
+  size_t n_pooled_bytes = 0;
+
+  static int get_size_class(const size_t size) {
+    int size_class = 0;
+    while (size_class < N_SIZE_CLASSES && (MIN_BLOCK_SIZE << size_class) < size) size_class++;
+    return size_class;
+  }
+
+  static size_t get_block_size(const size_t size, const int size_class) {
+    return size_class < N_SIZE_CLASSES ? MIN_BLOCK_SIZE << size_class : size;
+  }
+};
+
+// Allocates from the pool of the calling thread and returns blocks there for reuse. Meant for
+// short lived containers that are refilled over and over, such as the thread caches of the
+// concurrent containers and the remote maps of the distributed map, so that growing them again
+// does not go back to the system allocator and fault in fresh pages each time.
+template <class T>
+class PoolAllocator {
+ public:
+  typedef T value_type;
+
+  PoolAllocator() {}
+
+  template <class U>
+  PoolAllocator(const PoolAllocator<U>&) {}
+
+  T* allocate(const size_t n) {
+    return static_cast<T*>(MemoryPool::get_thread_pool().allocate(n * sizeof(T)));
+  }
+
+  void deallocate(T* ptr, const size_t n) {
+    MemoryPool::get_thread_pool().deallocate(ptr, n * sizeof(T));
+  }
+};
+
+template <class T, class U>
+bool operator==(const PoolAllocator<T>&, const PoolAllocator<U>&) {
+  return true;
+}
+
+template <class T, class U>
+bool operator!=(const PoolAllocator<T>&, const PoolAllocator<U>&) {
+  return false;
+}
+}  // namespace hpmr
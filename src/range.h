@@ -1,6 +1,7 @@
 #pragma once
 
 #include <functional>
+#include "dense_dist_map.h"
 #include "dist_map.h"
 
 namespace hpmr {
@@ -9,8 +10,23 @@ class Range {
  public:
   Range(const T start, const T end, const T step = 1) : start(start), end(end), step(step) {}
 
-  template <class K, class V, class H = std::hash<K>>
-  DistMap<K, V, H> mapreduce(
+  template <
+      class K,
+      class V,
+      class H = Hash<K>,
+      class P = PrimeBucketPolicy,
+      class A = std::allocator<char>,
+      class CA = A>
+  DistMap<K, V, H, P, A, CA> mapreduce(
+      const std::function<void(const T, const std::function<void(const K&, const V&)>&)>& mapper,
+      const std::function<void(V&, const V&)>& reducer,
+      const bool verbose = false);
+
+  // Reduces into a dense map for integer keys known to be in [key_lo, key_hi).
+  template <class K, class V, class A = std::allocator<char>, class CA = A>
+  DenseDistMap<K, V, A, CA> dense_mapreduce(
+      const K key_lo,
+      const K key_hi,
       const std::function<void(const T, const std::function<void(const K&, const V&)>&)>& mapper,
       const std::function<void(V&, const V&)>& reducer,
       const bool verbose = false);
@@ -23,15 +39,47 @@ class Range {
   T end;
 
   T step;
+
+  // Maps this process's share of the range into res, which needs async_set and sync.
+  template <class M, class K, class V>
+  void mapreduce_into(
+      M& res,
+      const std::function<void(const T, const std::function<void(const K&, const V&)>&)>& mapper,
+      const std::function<void(V&, const V&)>& reducer,
+      const bool verbose);
 };
 
 template <class T>
-template <class K, class V, class H>
-DistMap<K, V, H> Range<T>::mapreduce(
+template <class K, class V, class H, class P, class A, class CA>
+DistMap<K, V, H, P, A, CA> Range<T>::mapreduce(
+    const std::function<void(const T, const std::function<void(const K&, const V&)>&)>& mapper,
+    const std::function<void(V&, const V&)>& reducer,
+    const bool verbose) {
+  DistMap<K, V, H, P, A, CA> res;
+  mapreduce_into(res, mapper, reducer, verbose);
+  return res;
+}
+
+template <class T>
+template <class K, class V, class A, class CA>
+DenseDistMap<K, V, A, CA> Range<T>::dense_mapreduce(
+    const K key_lo,
+    const K key_hi,
+    const std::function<void(const T, const std::function<void(const K&, const V&)>&)>& mapper,
+    const std::function<void(V&, const V&)>& reducer,
+    const bool verbose) {
+  DenseDistMap<K, V, A, CA> res(key_lo, key_hi);
+  mapreduce_into(res, mapper, reducer, verbose);
+  return res;
+}
+
+template <class T>
+template <class M, class K, class V>
+void Range<T>::mapreduce_into(
+    M& res,
     const std::function<void(const T, const std::function<void(const K&, const V&)>&)>& mapper,
     const std::function<void(V&, const V&)>& reducer,
     const bool verbose) {
-  DistMap<K, V, H> res;
   int proc_id;
   int n_procs;
   MPI_Comm_size(MPI_COMM_WORLD, &n_procs);
@@ -59,8 +107,6 @@ DistMap<K, V, H> Range<T>::mapreduce(
   if (verbose && proc_id == 0) printf("\n");
 
   res.sync(reducer, verbose);
-
-  return res;
 }
 
 }  // namespace hpmr
@@ -14,3 +14,14 @@ TEST(RangeTest, MapReduceTest) {
   auto dist_map = range.mapreduce<int, bool>(mapper, hpmr::Reducer<bool>::keep);
   EXPECT_EQ(dist_map.get_n_keys(), N_KEYS);
 }
+
+TEST(RangeTest, DenseMapReduceTest) {
+  const int N_KEYS = 100000;
+  hpmr::Range<int> range(0, N_KEYS);
+  const auto& mapper = [](const int id, const std::function<void(const int&, const int&)>& emit) {
+    emit(id / 2, 1);
+  };
+  auto dense_map = range.dense_mapreduce<int, int>(0, N_KEYS / 2, mapper, hpmr::Reducer<int>::sum);
+  EXPECT_EQ(dense_map.get_n_keys(), N_KEYS / 2);
+  EXPECT_EQ(dense_map.get(123), 2);
+}
@@ -1,6 +1,8 @@
 #pragma once
 
+#include <cstring>
 #include <functional>
+#include <type_traits>
 
 namespace hpmr {
 
@@ -20,6 +22,71 @@ class Reducer {
   static void max(T& t1, const T& t2) {
     if (t1 > t2) t1 = t2;
   }
+
+  // Stateless functor versions of the reducers. The containers take reducers by type, so passing
+  // these instead of the functions above lets the compiler inline them into the insert path.
+  struct Keep {
+    void operator()(T& t1, const T& t2) const { keep(t1, t2); }
+  };
+
+  struct Overwrite {
+    void operator()(T& t1, const T& t2) const { overwrite(t1, t2); }
+  };
+
+  struct Sum {
+    void operator()(T& t1, const T& t2) const { sum(t1, t2); }
+  };
+
+  struct Min {
+    void operator()(T& t1, const T& t2) const { min(t1, t2); }
+  };
+
+  struct Max {
+    void operator()(T& t1, const T& t2) const { max(t1, t2); }
+  };
+};
+
+// Applies a reducer to a value other threads may be reducing at the same time. V must be trivially
+// copyable and at most 8 bytes. The generic version retries a compare and swap of the reduced copy
+// and stops once the reducer leaves the value unchanged, so Min and Max rarely write.
+template <class V, class R, class = void>
+struct AtomicReducer {
+  static void reduce(V& target, const V& value, const R& reducer) {
+    V expected;
+    __atomic_load(&target, &expected, __ATOMIC_RELAXED);
+    while (true) {
+      V desired = expected;
+      reducer(desired, value);
+      if (std::memcmp(&desired, &expected, sizeof(V)) == 0) return;
+      if (__atomic_compare_exchange(
+              &target, &expected, &desired, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        return;
+      }
+    }
+  }
+};
+
+template <class V>
+struct AtomicReducer<V, typename Reducer<V>::Keep> {
+  static void reduce(V&, const V&, const typename Reducer<V>::Keep&) {}
+};
+
+template <class V>
+struct AtomicReducer<V, typename Reducer<V>::Overwrite> {
+  static void reduce(V& target, const V& value, const typename Reducer<V>::Overwrite&) {
+    V desired = value;
+    __atomic_store(&target, &desired, __ATOMIC_RELAXED);
+  }
+};
+
+template <class V>
+struct AtomicReducer<
+    V,
+    typename Reducer<V>::Sum,
+    typename std::enable_if<std::is_integral<V>::value>::type> {
+  static void reduce(V& target, const V& value, const typename Reducer<V>::Sum&) {
+    __atomic_fetch_add(&target, value, __ATOMIC_RELAXED);
+  }
 };
 
 }  // namespace hpmr